@@ -0,0 +1,42 @@
+#include "aot.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Program.h>
+
+using namespace llvm;
+
+bool link_aot(const aot_options_t& options, std::string& error) {
+  auto linker = sys::findProgramByName(options.linker);
+  if (!linker) {
+    error = "Could not find linker " + options.linker + ": " + linker.getError().message();
+    return false;
+  }
+
+  SmallVector<StringRef, 16> args{ *linker, options.object_path };
+  for (const auto& module_object : options.module_objects) {
+    args.push_back(module_object);
+  }
+  if (options.output == aot_options_t::shared_library) {
+    args.push_back("-shared");
+    args.push_back("-fPIC");
+  }
+  else {
+    args.push_back(options.entry_object);
+  }
+  args.push_back(options.runtime_library);
+  for (const auto& flag : options.link_flags) {
+    args.push_back(flag);
+  }
+  args.push_back("-o");
+  args.push_back(options.output_path);
+
+  int result = sys::ExecuteAndWait(*linker, args, std::nullopt, {}, 0, 0, &error);
+  if (result != 0) {
+    if (error.empty()) {
+      error = options.linker + " exited with " + std::to_string(result);
+    }
+    return false;
+  }
+  return true;
+}
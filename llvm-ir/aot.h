@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+//===----------------------------------------------------------------------===//
+// Ahead-of-time output
+//
+// The object is emitted once into memory and the JIT loads it from there.
+// recompile_code writes it to object_path in the background when write_object
+// is set, and before linking. For executables and shared libraries the
+// script's main is emitted as fpp_main and the object is linked against the prebuilt runtime (libfpp_runtime.a, built from library.h by
+// wsl_build_run.sh). The runtime supplies the process entry point, a shared
+// library exports fpp_main for the host to call.
+//===----------------------------------------------------------------------===//
+
+struct aot_options_t {
+  enum output_e {
+    object,
+    executable,
+    shared_library
+  };
+  output_e output = object;
+
+  std::string object_path = "output.o";
+  bool write_object = false;
+  // objects of the imported modules, linked next to object_path
+  std::vector<std::string> module_objects;
+  // executable or shared library, unused for object output
+  std::string output_path = "a.fpp.out";
+  // tune for the host cpu instead of "generic"
+  bool native_cpu = true;
+  int opt_level = 2;
+
+  std::string linker = "clang++";
+  std::string runtime_library = "libfpp_runtime.a";
+  std::string entry_object = "fpp_main.o";
+  // extra libraries the runtime needs, e.g. fan and its dependencies
+  std::vector<std::string> link_flags;
+};
+
+/// link_aot - links options.object_path into options.output_path.
+bool link_aot(const aot_options_t& options, std::string& error);
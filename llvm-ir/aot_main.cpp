@@ -0,0 +1,21 @@
+// Process entry point for ahead-of-time compiled scripts (fpp_main.o). The
+// compiler emits the script's main as fpp_main.
+
+#include <pch.h>
+
+extern "C" double fpp_main();
+extern "C" void fpp_run_tasks();
+
+int main() {
+#ifndef no_graphics
+  loco_t loco;
+  fpp_main();
+  loco.loop([] {
+    fpp_run_tasks();
+  });
+#else
+  fpp_main();
+  fpp_run_tasks();
+#endif
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include "asset_cache.h"
+
+#include <algorithm>
+
+std::shared_ptr<const decoded_image_t> image_lru_t::find(const asset_key_t& key) {
+  auto found = index.find(key);
+  if (found == index.end()) {
+    return nullptr;
+  }
+  entries.splice(entries.begin(), entries, found->second);
+  return found->second->image;
+}
+
+void image_lru_t::insert(const asset_key_t& key, std::shared_ptr<const decoded_image_t> image) {
+  auto found = index.find(key);
+  if (found != index.end()) {
+    bytes -= found->second->image->bytes();
+    entries.erase(found->second);
+    index.erase(found);
+  }
+  if (!image || image->bytes() > capacity) {
+    return;
+  }
+  bytes += image->bytes();
+  entries.push_front(entry_t{ std::string(key.path), key.hash, std::move(image) });
+  const entry_t& entry = entries.front();
+  index.emplace(asset_key_t{ entry.path, entry.hash }, entries.begin());
+  evict();
+}
+
+void image_lru_t::evict() {
+  while (bytes > capacity && !entries.empty()) {
+    const entry_t& oldest = entries.back();
+    bytes -= oldest.image->bytes();
+    index.erase(asset_key_t{ oldest.path, oldest.hash });
+    entries.pop_back();
+  }
+}
+
+asset_loader_t::asset_loader_t(image_decoder_t decoder, std::size_t cache_bytes, unsigned threads)
+  : decoder(std::move(decoder)), cache(cache_bytes) {
+  if (threads == 0) {
+    // one core stays with the render thread, 0 means the count is unknown
+    threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+  }
+  for (unsigned i = 0; i < threads; ++i) {
+    workers.emplace_back([this] { work(); });
+  }
+}
+
+asset_loader_t::~asset_loader_t() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+std::shared_ptr<const decoded_image_t> asset_loader_t::request(const fpp_string_t& path) {
+  asset_key_t key{ fpp_view(path), path.hash };
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto image = cache.find(key)) {
+      return image;
+    }
+    if (in_flight.find(key) != in_flight.end()) {
+      return nullptr;
+    }
+    auto owned = std::make_unique<const std::string>(key.path);
+    key.path = *owned;
+    in_flight.emplace(key, std::move(owned));
+    queue.push_back(key);
+  }
+  wake.notify_one();
+  return nullptr;
+}
+
+void asset_loader_t::take_ready(std::vector<ready_t>& ready) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& image : finished) {
+    ready.push_back(std::move(image));
+  }
+  finished.clear();
+}
+
+void asset_loader_t::wait_idle() {
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return in_flight.empty(); });
+}
+
+std::size_t asset_loader_t::cache_bytes() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return cache.size_bytes();
+}
+
+void asset_loader_t::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (stopping) {
+      return;
+    }
+    asset_key_t key = queue.front();
+    queue.pop_front();
+    // the key views a string in_flight owns until the result is filed
+    ready_t result;
+    result.path = std::string(key.path);
+    result.hash = key.hash;
+    lock.unlock();
+
+    auto image = std::make_shared<decoded_image_t>();
+    if (decoder(result.path, *image)) {
+      result.image = std::move(image);
+    }
+
+    lock.lock();
+    if (result.image) {
+      cache.insert(asset_key_t{ result.path, result.hash }, result.image);
+    }
+    finished.push_back(std::move(result));
+    in_flight.erase(key);
+    if (in_flight.empty()) {
+      idle.notify_all();
+    }
+  }
+}
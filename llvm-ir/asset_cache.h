@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "asset_table.h"
+
+//===----------------------------------------------------------------------===//
+// Asset pipeline
+//
+// Images are read and decoded on a pool of worker threads as soon as a path
+// is requested, the pixels land in a size-bounded LRU cache and the render
+// thread only uploads them (see library.h). Nothing here touches the GPU or
+// fan, the decoder is passed in, so both layers run headless.
+//===----------------------------------------------------------------------===//
+
+struct decoded_image_t {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t channels = 0;
+  std::vector<uint8_t> pixels;
+
+  std::size_t bytes() const { return pixels.size(); }
+};
+
+/// image_decoder_t - fills image from the file at path, false on failure.
+/// Called on worker threads.
+using image_decoder_t = std::function<bool(const std::string& path, decoded_image_t& image)>;
+
+/// image_lru_t - decoded images by path, the least recently used are evicted
+/// once the pixels exceed capacity bytes. Not thread safe.
+struct image_lru_t {
+  explicit image_lru_t(std::size_t capacity) : capacity(capacity) {}
+
+  /// find - the image of key, null on a miss. A hit becomes most recent.
+  std::shared_ptr<const decoded_image_t> find(const asset_key_t& key);
+
+  /// insert - adds or replaces the image of key, then evicts. An image larger
+  /// than the whole cache is not kept.
+  void insert(const asset_key_t& key, std::shared_ptr<const decoded_image_t> image);
+
+  std::size_t size_bytes() const { return bytes; }
+  std::size_t count() const { return entries.size(); }
+
+private:
+  struct entry_t {
+    std::string path;
+    uint64_t hash;
+    std::shared_ptr<const decoded_image_t> image;
+  };
+  void evict();
+
+  std::size_t capacity;
+  std::size_t bytes = 0;
+  // most recent first, the index keys view the paths stored in the list
+  std::list<entry_t> entries;
+  std::unordered_map<asset_key_t, std::list<entry_t>::iterator, asset_key_hash_t, asset_key_equal_t> index;
+};
+
+/// asset_loader_t - decodes requested images on worker threads into an
+/// image_lru_t. All members are thread safe.
+struct asset_loader_t {
+  struct ready_t {
+    std::string path;
+    uint64_t hash = 0;
+    // null when decoding failed
+    std::shared_ptr<const decoded_image_t> image;
+  };
+
+  // 0 threads runs one per core, minus the render thread
+  asset_loader_t(image_decoder_t decoder, std::size_t cache_bytes = 256u << 20, unsigned threads = 0);
+  ~asset_loader_t();
+
+  /// request - starts decoding path unless it is cached or being decoded.
+  /// Returns the cached image right away on a hit, null otherwise.
+  std::shared_ptr<const decoded_image_t> request(const fpp_string_t& path);
+
+  /// take_ready - moves the images decoded since the last call into ready.
+  void take_ready(std::vector<ready_t>& ready);
+
+  /// wait_idle - blocks until every request was decoded.
+  void wait_idle();
+
+  std::size_t cache_bytes();
+
+private:
+  void work();
+
+  image_decoder_t decoder;
+  std::mutex mutex;
+  std::condition_variable wake, idle;
+  image_lru_t cache;
+  // paths waiting for a worker, oldest first
+  std::deque<asset_key_t> queue;
+  std::vector<ready_t> finished;
+  // queued or decoding paths, the keys view the strings they own
+  std::unordered_map<asset_key_t, std::unique_ptr<const std::string>, asset_key_hash_t, asset_key_equal_t> in_flight;
+  std::size_t decoding = 0;
+  bool stopping = false;
+  std::vector<std::thread> workers;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "fpp_string.h"
+
+//===----------------------------------------------------------------------===//
+// Asset table
+//
+// Every asset path the process uses gets a small integer id, and the render
+// thread keeps images by id in a plain array. An 'asset' parameter receives a
+// fpp_asset_t. The compiler turns each literal passed to one into an entry of
+// the module's asset table, whose id is 0 until the first call fills it in,
+// so every later call costs a load. Ids are handed out at run time, objects
+// written to disk or cached by the module build never contain one.
+//===----------------------------------------------------------------------===//
+
+/// fpp_asset_t - a path and its id, codegen lays it out as { ptr, i32 }.
+struct fpp_asset_t {
+  const fpp_string_t* path;
+  std::atomic<uint32_t> id;
+};
+
+/// asset_key_t - a path with its fpp_hash, lookups never rehash the path.
+struct asset_key_t {
+  std::string_view path;
+  uint64_t hash;
+};
+
+struct asset_key_hash_t {
+  using is_transparent = void;
+  std::size_t operator()(const asset_key_t& key) const { return key.hash; }
+};
+
+struct asset_key_equal_t {
+  using is_transparent = void;
+  bool operator()(const asset_key_t& a, const asset_key_t& b) const {
+    return a.hash == b.hash && a.path == b.path;
+  }
+};
+
+/// asset_table_t - ids by path for the whole process, entries are never
+/// freed. All members are thread safe.
+struct asset_table_t {
+  // id 0 is the empty path, what a null asset resolves to
+  asset_table_t() { slot(fpp_make_string("", 0)); }
+
+  /// slot - the entry of path, created with the next id on first use. For
+  /// paths only known at run time.
+  fpp_asset_t* slot(const fpp_string_t& path) {
+    std::lock_guard lock(mutex);
+    auto found = index.find(asset_key_t{ fpp_view(path), path.hash });
+    if (found != index.end()) {
+      return &found->second->asset;
+    }
+    auto& entry = *entries.emplace_back(std::make_unique<entry_t>());
+    entry.chars.assign(path.data, path.size);
+    entry.path = fpp_string_t{ entry.chars.c_str(), path.size, path.hash };
+    entry.asset.path = &entry.path;
+    entry.asset.id.store((uint32_t)entries.size() - 1, std::memory_order_relaxed);
+    index.emplace(asset_key_t{ entry.chars, path.hash }, &entry);
+    return &entry.asset;
+  }
+
+  /// intern - the id of path.
+  uint32_t intern(const fpp_string_t& path) {
+    return slot(path)->id.load(std::memory_order_relaxed);
+  }
+
+  /// path - the path of id, valid for the life of the process.
+  const fpp_string_t& path(uint32_t id) {
+    std::lock_guard lock(mutex);
+    return entries[id]->path;
+  }
+
+private:
+  struct entry_t {
+    std::string chars;
+    fpp_string_t path;
+    fpp_asset_t asset;
+  };
+  std::mutex mutex;
+  // by id, boxed so the entries and the keys viewing them never move
+  std::vector<std::unique_ptr<entry_t>> entries;
+  std::unordered_map<asset_key_t, entry_t*, asset_key_hash_t, asset_key_equal_t> index;
+};
+
+inline asset_table_t& asset_table() {
+  static asset_table_t table;
+  return table;
+}
+
+/// fpp_asset_id - the id of asset, interning its path on the first call.
+/// Racing first calls intern the same path and store the same id.
+inline uint32_t fpp_asset_id(fpp_asset_t* asset) {
+  if (!asset) {
+    return 0;
+  }
+  uint32_t id = asset->id.load(std::memory_order_relaxed);
+  if (id == 0) {
+    id = asset_table().intern(*asset->path);
+    asset->id.store(id, std::memory_order_relaxed);
+  }
+  return id;
+}
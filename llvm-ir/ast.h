@@ -1,8 +1,9 @@
 #pragma once
 
-#include "lexer.h"
+#include <functional>
+#include <set>
 
-extern std::unique_ptr<llvm::LLVMContext> TheContext;
+#include "lexer.h"
 
 
 //===----------------------------------------------------------------------===//
@@ -13,6 +14,25 @@ struct ast_t : lexer_t {
   static llvm::raw_ostream& indent(llvm::raw_ostream& O, int size) {
     return O << std::string(size, ' ');
   }
+
+  /// attribute_t - an '@name' or '@name(N)' hint written before a def,
+  /// extern, for, if or call.
+  struct attribute_t {
+    std::string name;
+    double value = 0;
+    bool has_value = false;
+    source_location_t loc;
+  };
+  using attributes_t = std::vector<attribute_t>;
+
+  /// find_attribute - returns the attribute called name or nullptr.
+  static const attribute_t* find_attribute(const attributes_t& attributes, const std::string& name) {
+    for (const auto& attribute : attributes) {
+      if (attribute.name == name)
+        return &attribute;
+    }
+    return nullptr;
+  }
   /// ExprAST - Base class for all expression nodes.
   class ExprAST {
   public:
@@ -31,6 +51,8 @@ struct ast_t : lexer_t {
 
     source_location_t loc;
     ExprKind Kind;
+    // hints the parser attached, only for, if and calls take any
+    attributes_t Attributes;
 
   public:
     // lazy implement xd
@@ -42,6 +64,9 @@ struct ast_t : lexer_t {
     int getLine() const { return loc.line; }
     ExprKind getKind() const { return Kind; }
     int getCol() const { return loc.col; }
+    const attributes_t& getAttributes() const { return Attributes; }
+    void setAttributes(attributes_t attributes) { Attributes = std::move(attributes); }
+    const attribute_t* getAttribute(const std::string& name) const { return find_attribute(Attributes, name); }
     virtual llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) {
       return out << ':' << getLine() << ':' << getCol() << '\n';
     }
@@ -53,6 +78,10 @@ struct ast_t : lexer_t {
 
   public:
     NumberExprAST(source_location_t loc, double Val) : ExprAST(Expr_Number, loc), Val(Val) {}
+    double getVal() const { return Val; }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_Number;
+    }
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       return ExprAST::dump(out << Val, ind);
     }
@@ -71,6 +100,9 @@ struct ast_t : lexer_t {
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       return ExprAST::dump(out << Name, ind);
     }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_Variable;
+    }
   };
 
   /// UnaryExprAST - Expression class for a unary operator.
@@ -81,12 +113,17 @@ struct ast_t : lexer_t {
   public:
     UnaryExprAST(source_location_t loc, char Opcode, std::unique_ptr<ExprAST> Operand)
       : ExprAST(Expr_Unary, loc), Opcode(Opcode), Operand(std::move(Operand)) {}
+    char getOpcode() const { return Opcode; }
+    std::unique_ptr<ExprAST>& getOperand() { return Operand; }
     llvm::Value* codegen(ast_t* ast) override;
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       ExprAST::dump(out << "unary" << Opcode, ind);
       Operand->dump(out, ind + 1);
       return out;
     }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_Unary;
+    }
   };
 
   /// BinaryExprAST - Expression class for a binary operator.
@@ -98,6 +135,9 @@ struct ast_t : lexer_t {
     BinaryExprAST(source_location_t loc, char Op, std::unique_ptr<ExprAST> LHS,
       std::unique_ptr<ExprAST> RHS)
       : ExprAST(Expr_Binary, loc), Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+    char getOp() const { return Op; }
+    std::unique_ptr<ExprAST>& getLHS() { return LHS; }
+    std::unique_ptr<ExprAST>& getRHS() { return RHS; }
     llvm::Value* codegen(ast_t* ast) override;
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       ExprAST::dump(out << "binary" << Op, ind);
@@ -105,6 +145,9 @@ struct ast_t : lexer_t {
       RHS->dump(indent(out, ind) << "RHS:", ind + 1);
       return out;
     }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_Binary;
+    }
   };
 
   /// CallExprAST - Expression class for function calls.
@@ -116,6 +159,8 @@ struct ast_t : lexer_t {
     CallExprAST(source_location_t loc, const std::string& Callee,
       std::vector<std::unique_ptr<ExprAST>> Args)
       : ExprAST(Expr_Call, loc), Callee(Callee), Args(std::move(Args)) {}
+    const std::string& getCallee() const { return Callee; }
+    std::vector<std::unique_ptr<ExprAST>>& getArgs() { return Args; }
     llvm::Value* codegen(ast_t* ast) override;
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       ExprAST::dump(out << "call " << Callee, ind);
@@ -123,6 +168,9 @@ struct ast_t : lexer_t {
         Arg->dump(indent(out, ind + 1), ind + 1);
       return out;
     }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_Call;
+    }
   };
 
   /// IfExprAST - Expression class for if/then/else.
@@ -134,6 +182,9 @@ struct ast_t : lexer_t {
       std::unique_ptr<ExprAST> Then, std::unique_ptr<ExprAST> Else)
       : ExprAST(Expr_If, loc), Cond(std::move(Cond)), Then(std::move(Then)),
       Else(std::move(Else)) {}
+    std::unique_ptr<ExprAST>& getCond() { return Cond; }
+    std::unique_ptr<ExprAST>& getThen() { return Then; }
+    std::unique_ptr<ExprAST>& getElse() { return Else; }
     llvm::Value* codegen(ast_t* ast) override;
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       ExprAST::dump(out << "if", ind);
@@ -142,6 +193,9 @@ struct ast_t : lexer_t {
       Else->dump(indent(out, ind) << "Else:", ind + 1);
       return out;
     }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_If;
+    }
   };
 
   class CompoundExprAST : public ExprAST {
@@ -159,7 +213,7 @@ struct ast_t : lexer_t {
           return nullptr;
       }
 
-      return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*TheContext));
+      return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*ast->TheContext));
     }
     static bool classof(const ExprAST* E) {
       return E->getKind() == Expr_Compound;
@@ -178,6 +232,12 @@ struct ast_t : lexer_t {
       std::unique_ptr<ExprAST> Body)
       : ExprAST(Expr_For, loc), VarName(VarName), Start(std::move(Start)), End(std::move(End)),
       Step(std::move(Step)), Body(std::move(Body)) {}
+    const std::string& getVarName() const { return VarName; }
+    std::unique_ptr<ExprAST>& getStart() { return Start; }
+    std::unique_ptr<ExprAST>& getEnd() { return End; }
+    // null when the loop uses the default step of 1.0
+    std::unique_ptr<ExprAST>& getStep() { return Step; }
+    std::unique_ptr<ExprAST>& getBody() { return Body; }
     llvm::Value* codegen(ast_t* ast) override;
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       ExprAST::dump(out << "for", ind);
@@ -187,6 +247,9 @@ struct ast_t : lexer_t {
       Body->dump(indent(out, ind) << "Body:", ind + 1);
       return out;
     }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_For;
+    }
   };
 
   /// VarExprAST - Expression class for var/in
@@ -200,6 +263,9 @@ struct ast_t : lexer_t {
       std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames,
       std::unique_ptr<ExprAST> Body)
       : ExprAST(Expr_Var, loc), VarNames(std::move(VarNames)), Body(std::move(Body)) {}
+    // initializers are null for variables defaulting to 0.0
+    std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>>& getVarNames() { return VarNames; }
+    std::unique_ptr<ExprAST>& getBody() { return Body; }
     llvm::Value* codegen(ast_t* ast) override;
     llvm::raw_ostream& dump(llvm::raw_ostream& out, int ind) override {
       ExprAST::dump(out << "var", ind);
@@ -208,6 +274,9 @@ struct ast_t : lexer_t {
       Body->dump(indent(out, ind) << "Body:", ind + 1);
       return out;
     }
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_Var;
+    }
   };
 
   /// PrototypeAST - This class represents the "prototype" for a function,
@@ -220,6 +289,8 @@ struct ast_t : lexer_t {
     bool IsOperator;
     unsigned Precedence;
     source_location_t loc;
+    bool FastMath = false;
+    attributes_t Attributes;
 
   public:
     PrototypeAST(const source_location_t& loc, const std::string& Name,
@@ -230,6 +301,8 @@ struct ast_t : lexer_t {
 
     llvm::Function* codegen(ast_t* ast);
     const std::string& getName() const { return Name; }
+    const std::vector<std::string>& getArgs() const { return Args; }
+    const std::vector<std::string>& getArgTypes() const { return ArgTypes; }
 
     bool isUnaryOp() const { return IsOperator && Args.size() == 1; }
     bool isBinaryOp() const { return IsOperator && Args.size() == 2; }
@@ -241,6 +314,13 @@ struct ast_t : lexer_t {
 
     unsigned getBinaryPrecedence() const { return Precedence; }
     int getLine() const { return loc.line; }
+
+    bool isFastMath() const { return FastMath; }
+    void setFastMath(bool fast_math) { FastMath = fast_math; }
+
+    const attributes_t& getAttributes() const { return Attributes; }
+    void setAttributes(attributes_t attributes) { Attributes = std::move(attributes); }
+    const attribute_t* getAttribute(const std::string& name) const { return find_attribute(Attributes, name); }
   };
 
 
@@ -260,8 +340,9 @@ struct ast_t : lexer_t {
       indent(out, ind) << "Body:";
       return Body ? Body->dump(out, ind) : out << "null\n";
     }
-    const PrototypeAST& getProto() const;
-    const std::string& getName() const;
+    const PrototypeAST& getProto() const { return *Proto; }
+    const std::string& getName() const { return Proto->getName(); }
+    std::unique_ptr<ExprAST>& getBody() { return Body; }
   };
 
   class StringExprAST : public ExprAST {
@@ -269,8 +350,10 @@ struct ast_t : lexer_t {
 
   public:
     StringExprAST(source_location_t loc, const std::string& Val) : ExprAST(Expr_String, loc), Val(Val) {}
-    llvm::Value* codegen(ast_t* ast) override {
-      return ir_builder->CreateGlobalStringPtr(Val, "str");
+    const std::string& getVal() const { return Val; }
+    llvm::Value* codegen(ast_t* ast) override;
+    static bool classof(const ExprAST* E) {
+      return E->getKind() == Expr_String;
     }
   };
 
@@ -312,14 +395,14 @@ struct ast_t : lexer_t {
 
     void emit_location(auto AST) {
       if constexpr (std::is_null_pointer_v<decltype(AST)>)
-        return ir_builder->SetCurrentDebugLocation(llvm::DebugLoc());
+        return get_ast()->ir_builder->SetCurrentDebugLocation(llvm::DebugLoc());
       else {
         llvm::DIScope* Scope;
         if (lexical_blocks.empty())
           Scope = di_compile_unit;
         else
           Scope = lexical_blocks.back();
-        ir_builder->SetCurrentDebugLocation(llvm::DILocation::get(
+        get_ast()->ir_builder->SetCurrentDebugLocation(llvm::DILocation::get(
           Scope->getContext(), AST->getLine(), AST->getCol(), Scope));
       }
     }
@@ -390,7 +473,143 @@ struct ast_t : lexer_t {
     { '!', 50 },
   };
 
+  // module wide fast-math, the parser copies it into every prototype
+  bool fast_math = false;
+
+  // prefix of the globals codegen adds next to the script's own, e.g. memo
+  // tables and profile counters. Imported modules load into the engine of
+  // the script importing them, so each object needs its own.
+  std::string symbol_scope;
+  std::string scoped(const std::string& name) const { return symbol_scope + name; }
+
+  // called once per distinct literal passed to an 'asset' parameter while
+  // the module is generated, so the host can start loading the file
+  std::function<void(const std::string& callee, const std::string& path)> prefetch_asset;
+
+  // tiered compilation state used by codegen, see tiering.h
+  struct tier_info_t {
+    bool enabled = false;
+    // enabled and the code stays in this process, set by init_llvm. Written
+    // objects have no tiering_t to call back into.
+    bool active = false;
+    uint64_t threshold = 1000;
+    std::vector<std::string> functions;
+    std::map<std::string, uint32_t> index;
+    // index of the function being generated, -1 if it is not tiered
+    int current = -1;
+    // main has a loop, set by codegen
+    bool main_loops = false;
+    // opt-in, run_code compiles a main with loops at O2 before it starts
+    // instead of running it at tier 0
+    bool optimize_main = false;
+
+    void reset() {
+      active = false;
+      functions.clear();
+      index.clear();
+      current = -1;
+      main_loops = false;
+    }
+  }tier;
+
+  // profile guided optimization state used by codegen, see pgo.h
+  struct pgo_info_t {
+    enum mode_e {
+      off,
+      generate, // emit counters
+      use       // apply profile
+    };
+    // when enabled, each compile uses the saved profile if it matches the
+    // key and instruments otherwise
+    bool enabled = false;
+    mode_e mode = off;
+    uint64_t source_hash = 0;
+    // source_hash and the settings the counters were numbered under
+    uint64_t key = 0;
+    // functions entered at least this often are marked hot
+    uint64_t hot_count = 1000;
+    std::map<std::string, std::vector<uint64_t>> profile;
+    // counter globals of the instrumented module and their (function, slot)
+    std::vector<std::pair<std::string, uint32_t>> counters;
+    // counters codegen reserved per function
+    std::map<std::string, uint32_t> slots;
+    // main finished, the counters hold a run worth saving
+    bool counted = false;
+    // functions whose profile entry did not match, generated without it
+    uint32_t rejected = 0;
+    // function being generated and its next free counter
+    std::string function;
+    uint32_t next_counter = 0;
+    // branches of the function carrying profile weights, with the weights
+    // they get without a profile
+    std::vector<std::pair<llvm::Instruction*, llvm::MDNode*>> weighted;
+
+    void reset() {
+      mode = off;
+      profile.clear();
+      counters.clear();
+      slots.clear();
+      counted = false;
+      rejected = 0;
+      function.clear();
+      next_counter = 0;
+      weighted.clear();
+    }
+  }pgo;
+
+  // tail positions of the function being generated, see FunctionAST::codegen
+  struct tail_info_t {
+    // calls whose value is the function's result
+    std::set<const ExprAST*> returned;
+    // self calls lowered to a jump back to header
+    std::set<const ExprAST*> self;
+    // the body is a compound, so every path returns 0.0
+    bool zero_result = false;
+    llvm::BasicBlock* header = nullptr;
+    std::vector<llvm::AllocaInst*> args;
+
+    void reset() {
+      returned.clear();
+      self.clear();
+      zero_result = false;
+      header = nullptr;
+      args.clear();
+    }
+  }tail;
+
+  // '@memo' functions of the module, their tables are zeroed globals so every
+  // engine that loads the object starts empty
+  struct memo_info_t {
+    struct table_t {
+      std::string function;
+      uint32_t arity = 0;
+      uint32_t capacity = 0;
+    };
+    // slots used when '@memo' has no size
+    uint32_t default_capacity = 4096;
+    // slots looked at before giving up on caching a result
+    uint32_t max_probes = 8;
+    std::vector<table_t> tables;
+
+    void reset() {
+      tables.clear();
+    }
+  }memo;
+
+  // compiler state is per instance, so several can compile at once. The
+  // context is declared first to outlive everything created in it.
+  std::unique_ptr<llvm::LLVMContext> TheContext;
+  std::unique_ptr<llvm::IRBuilder<>> ir_builder;
+  std::map<std::string, llvm::AllocaInst*> NamedValues;
+  // the fpp_string_t constant of each distinct literal in TheModule
+  std::map<std::string, llvm::GlobalVariable*, std::less<>> string_pool;
+  // the module's asset table, one fpp_asset_t per distinct literal path
+  std::map<std::string, llvm::GlobalVariable*, std::less<>> asset_pool;
+
   std::map<std::string, std::unique_ptr<ast_t::PrototypeAST>> FunctionProtos;
+  // defs the script gives a body, parsed or imported. Known before codegen
+  // starts, so a def below its first caller still shadows a math builtin.
+  std::set<std::string> script_defs;
   std::unique_ptr<llvm::Module> TheModule;
   std::unique_ptr<llvm::DIBuilder> DBuilder;
 };
\ No newline at end of file
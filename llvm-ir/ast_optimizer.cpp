@@ -0,0 +1,714 @@
+#include "ast_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+
+#include "math_library.h"
+
+using ExprAST = ast_t::ExprAST;
+using expr_ptr = std::unique_ptr<ExprAST>;
+
+/// truth - same test as the fcmp one codegen emits for if/for conditions.
+static bool truth(double value) {
+  return value < 0.0 || value > 0.0;
+}
+
+static ast_t::NumberExprAST* as_number(const expr_ptr& expr) {
+  return expr ? llvm::dyn_cast<ast_t::NumberExprAST>(expr.get()) : nullptr;
+}
+
+static expr_ptr make_number(const source_location_t& loc, double value) {
+  return std::make_unique<ast_t::NumberExprAST>(loc, value);
+}
+
+static bool is_builtin_binary(char op) {
+  return std::strchr("+-*/<>%|&", op) != nullptr;
+}
+
+/// fold_binary - evaluates a builtin binary operator the way codegen lowers
+/// it, false for operators that go to a user 'binary' def.
+static bool fold_binary(char op, double l, double r, double& result) {
+  switch (op) {
+  case '+': result = l + r; return true;
+  case '-': result = l - r; return true;
+  case '*': result = l * r; return true;
+  case '/': result = l / r; return true;
+  // unordered compares, true when either side is NaN
+  case '<': result = !(l >= r) ? 1.0 : 0.0; return true;
+  case '>': result = !(l <= r) ? 1.0 : 0.0; return true;
+  case '%': result = l - std::floor(l / r) * r; return true;
+  case '|': result = (l != 0.0 || r != 0.0) ? 1.0 : 0.0; return true;
+  case '&': result = (l != 0.0 && r != 0.0) ? 1.0 : 0.0; return true;
+  default: return false;
+  }
+}
+
+/// fold_unary - unary '&' is left to codegen.
+static bool fold_unary(char op, double operand, double& result) {
+  switch (op) {
+  case '-': result = -operand; return true;
+  case '!': result = operand == 0.0 ? 1.0 : 0.0; return true;
+  default: return false;
+  }
+}
+
+static bool is_builtin_call(const std::set<std::string>& defined, const std::string& callee) {
+  return find_math_builtin(callee) && !defined.count(callee);
+}
+
+/// for_each_child - calls fn on every direct subexpression of expr.
+template <typename fn_t>
+static void for_each_child(ExprAST* expr, fn_t&& fn) {
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Unary:
+    fn(static_cast<ast_t::UnaryExprAST*>(expr)->getOperand());
+    break;
+  case ExprAST::Expr_Binary: {
+    auto* binary = static_cast<ast_t::BinaryExprAST*>(expr);
+    fn(binary->getLHS());
+    fn(binary->getRHS());
+    break;
+  }
+  case ExprAST::Expr_Call:
+    for (auto& arg : static_cast<ast_t::CallExprAST*>(expr)->getArgs()) {
+      fn(arg);
+    }
+    break;
+  case ExprAST::Expr_If: {
+    auto* if_expr = static_cast<ast_t::IfExprAST*>(expr);
+    fn(if_expr->getCond());
+    fn(if_expr->getThen());
+    fn(if_expr->getElse());
+    break;
+  }
+  case ExprAST::Expr_For: {
+    auto* for_expr = static_cast<ast_t::ForExprAST*>(expr);
+    fn(for_expr->getStart());
+    fn(for_expr->getEnd());
+    fn(for_expr->getStep());
+    fn(for_expr->getBody());
+    break;
+  }
+  case ExprAST::Expr_Var: {
+    auto* var = static_cast<ast_t::VarExprAST*>(expr);
+    for (auto& binding : var->getVarNames()) {
+      fn(binding.second);
+    }
+    fn(var->getBody());
+    break;
+  }
+  case ExprAST::Expr_Compound:
+    for (auto& statement : static_cast<ast_t::CompoundExprAST*>(expr)->getStatements()) {
+      fn(statement);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+static bool has_assignment(ExprAST* expr) {
+  if (!expr) {
+    return false;
+  }
+  if (auto* binary = llvm::dyn_cast<ast_t::BinaryExprAST>(expr); binary && binary->getOp() == '=') {
+    return true;
+  }
+  bool found = false;
+  for_each_child(expr, [&found](expr_ptr& child) {
+    found = found || has_assignment(child.get());
+  });
+  return found;
+}
+
+/// assigns - true if expr stores to the binding of name visible at its root.
+static bool assigns(ExprAST* expr, const std::string& name) {
+  if (!expr) {
+    return false;
+  }
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Binary: {
+    auto* binary = static_cast<ast_t::BinaryExprAST*>(expr);
+    if (binary->getOp() == '=') {
+      auto* destination = llvm::dyn_cast<ast_t::VariableExprAST>(binary->getLHS().get());
+      if (!destination || destination->getName() == name) {
+        return true;
+      }
+      return assigns(binary->getRHS().get(), name);
+    }
+    break;
+  }
+  case ExprAST::Expr_For: {
+    auto* for_expr = static_cast<ast_t::ForExprAST*>(expr);
+    if (assigns(for_expr->getStart().get(), name)) {
+      return true;
+    }
+    // the loop variable shadows name in the rest of the loop
+    if (for_expr->getVarName() == name) {
+      return false;
+    }
+    return assigns(for_expr->getEnd().get(), name) || assigns(for_expr->getStep().get(), name) ||
+      assigns(for_expr->getBody().get(), name);
+  }
+  case ExprAST::Expr_Var: {
+    auto* var = static_cast<ast_t::VarExprAST*>(expr);
+    for (auto& [var_name, init] : var->getVarNames()) {
+      if (assigns(init.get(), name)) {
+        return true;
+      }
+      if (var_name == name) {
+        return false;
+      }
+    }
+    return assigns(var->getBody().get(), name);
+  }
+  default:
+    break;
+  }
+  bool found = false;
+  for_each_child(expr, [&](expr_ptr& child) {
+    found = found || assigns(child.get(), name);
+  });
+  return found;
+}
+
+/// substitute - replaces reads of the binding of name visible at expr's root
+/// with value. The binding must not be assigned, see assigns.
+static void substitute(expr_ptr& expr, const std::string& name, double value) {
+  if (!expr) {
+    return;
+  }
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Variable:
+    if (static_cast<ast_t::VariableExprAST*>(expr.get())->getName() == name) {
+      expr = make_number(expr->loc, value);
+    }
+    return;
+  case ExprAST::Expr_For: {
+    auto* for_expr = static_cast<ast_t::ForExprAST*>(expr.get());
+    substitute(for_expr->getStart(), name, value);
+    if (for_expr->getVarName() != name) {
+      substitute(for_expr->getEnd(), name, value);
+      substitute(for_expr->getStep(), name, value);
+      substitute(for_expr->getBody(), name, value);
+    }
+    return;
+  }
+  case ExprAST::Expr_Var: {
+    auto* var = static_cast<ast_t::VarExprAST*>(expr.get());
+    for (auto& [var_name, init] : var->getVarNames()) {
+      substitute(init, name, value);
+      if (var_name == name) {
+        return;
+      }
+    }
+    substitute(var->getBody(), name, value);
+    return;
+  }
+  default:
+    for_each_child(expr.get(), [&](expr_ptr& child) {
+      substitute(child, name, value);
+    });
+    return;
+  }
+}
+
+/// calls_only - true if every call in expr, including user operators, goes
+/// to a builtin or a function in allowed.
+static bool calls_only(ExprAST* expr, const std::set<std::string>& defined, const std::set<std::string>& allowed) {
+  if (!expr) {
+    return true;
+  }
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Call: {
+    const std::string& callee = static_cast<ast_t::CallExprAST*>(expr)->getCallee();
+    if (!allowed.count(callee) && !is_builtin_call(defined, callee)) {
+      return false;
+    }
+    break;
+  }
+  case ExprAST::Expr_Unary: {
+    char op = static_cast<ast_t::UnaryExprAST*>(expr)->getOpcode();
+    if (op != '-' && op != '!' && op != '&' && !allowed.count(std::string("unary") + op)) {
+      return false;
+    }
+    break;
+  }
+  case ExprAST::Expr_Binary: {
+    char op = static_cast<ast_t::BinaryExprAST*>(expr)->getOp();
+    if (op != '=' && !is_builtin_binary(op) && !allowed.count(std::string("binary") + op)) {
+      return false;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  bool only = true;
+  for_each_child(expr, [&](expr_ptr& child) {
+    only = only && calls_only(child.get(), defined, allowed);
+  });
+  return only;
+}
+
+void ast_optimizer_t::find_pure(std::vector<std::unique_ptr<ast_t::FunctionAST>>& functions) {
+  pure.clear();
+  for (auto& function : functions) {
+    const auto& types = function->getProto().getArgTypes();
+    if (std::all_of(types.begin(), types.end(), [](const std::string& type) { return type == "double"; })) {
+      pure.insert(function->getName());
+    }
+  }
+  // Start optimistic so recursion stays pure, drop callers of anything
+  // impure until nothing changes.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto& function : functions) {
+      if (pure.count(function->getName()) && !calls_only(function->getBody().get(), defined, pure)) {
+        pure.erase(function->getName());
+        changed = true;
+      }
+    }
+  }
+}
+
+bool ast_optimizer_t::evaluate(const std::string& callee, const std::vector<double>& args, double& result) {
+  std::string key = callee;
+  for (double arg : args) {
+    uint64_t bits;
+    std::memcpy(&bits, &arg, sizeof(bits));
+    key += "," + std::to_string(bits);
+  }
+  auto [found, inserted] = evaluated.try_emplace(key);
+  if (inserted) {
+    std::vector<interpreter_t::value_t> values;
+    for (double arg : args) {
+      values.push_back({ arg });
+    }
+    interpreter_t::value_t value;
+    if (evaluator.call(callee, values, value)) {
+      found->second = value.number;
+    }
+  }
+  if (!found->second) {
+    return false;
+  }
+  result = *found->second;
+  return true;
+}
+
+void ast_optimizer_t::run(std::vector<std::unique_ptr<ast_t::FunctionAST>>& functions) {
+  defined.clear();
+  for (auto& function : functions) {
+    defined.insert(function->getName());
+  }
+  evaluated.clear();
+  if (evaluate_calls) {
+    find_pure(functions);
+    // no externs are registered, the evaluator can only run pure code
+    evaluator.step_budget = step_budget;
+    evaluator.depth_limit = depth_limit;
+    evaluator.stack_limit = stack_limit;
+    evaluator.bind(functions);
+  }
+  for (auto& function : functions) {
+    next_temp = 0;
+    simplify(function->getBody());
+    eliminate_common(function->getBody());
+  }
+}
+
+void ast_optimizer_t::simplify(expr_ptr& expr) {
+  if (!expr) {
+    return;
+  }
+
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Unary: {
+    auto* unary = static_cast<ast_t::UnaryExprAST*>(expr.get());
+    simplify(unary->getOperand());
+    double result;
+    auto* operand = as_number(unary->getOperand());
+    if (operand && fold_unary(unary->getOpcode(), operand->getVal(), result)) {
+      expr = make_number(expr->loc, result);
+      ++stats.folded;
+    }
+    else if (operand && evaluate_calls && pure.count(std::string("unary") + unary->getOpcode()) &&
+      evaluate(std::string("unary") + unary->getOpcode(), { operand->getVal() }, result)) {
+      expr = make_number(expr->loc, result);
+      ++stats.evaluated;
+    }
+    break;
+  }
+  case ExprAST::Expr_Binary: {
+    auto* binary = static_cast<ast_t::BinaryExprAST*>(expr.get());
+    if (binary->getOp() != '=') {
+      simplify(binary->getLHS());
+    }
+    simplify(binary->getRHS());
+    auto* l = as_number(binary->getLHS());
+    auto* r = as_number(binary->getRHS());
+    double result;
+    if (l && r && fold_binary(binary->getOp(), l->getVal(), r->getVal(), result)) {
+      expr = make_number(expr->loc, result);
+      ++stats.folded;
+    }
+    else if (l && r && evaluate_calls && pure.count(std::string("binary") + binary->getOp()) &&
+      evaluate(std::string("binary") + binary->getOp(), { l->getVal(), r->getVal() }, result)) {
+      expr = make_number(expr->loc, result);
+      ++stats.evaluated;
+    }
+    break;
+  }
+  case ExprAST::Expr_Call: {
+    auto* call = static_cast<ast_t::CallExprAST*>(expr.get());
+    bool constant = true;
+    for (auto& arg : call->getArgs()) {
+      simplify(arg);
+      constant = constant && as_number(arg);
+    }
+    if (!constant) {
+      break;
+    }
+    if (evaluate_calls && pure.count(call->getCallee())) {
+      std::vector<double> args;
+      for (auto& arg : call->getArgs()) {
+        args.push_back(as_number(arg)->getVal());
+      }
+      double result;
+      if (evaluate(call->getCallee(), args, result)) {
+        expr = make_number(expr->loc, result);
+        ++stats.evaluated;
+      }
+      break;
+    }
+    if (!is_builtin_call(defined, call->getCallee())) {
+      break;
+    }
+    auto* builtin = find_math_builtin(call->getCallee());
+    if (builtin->arity != call->getArgs().size()) {
+      break; // codegen reports it
+    }
+    double args[3]{};
+    for (std::size_t i = 0; i < call->getArgs().size(); ++i) {
+      args[i] = as_number(call->getArgs()[i])->getVal();
+    }
+    expr = make_number(expr->loc, builtin->eval(args));
+    ++stats.folded;
+    break;
+  }
+  case ExprAST::Expr_If: {
+    auto* if_expr = static_cast<ast_t::IfExprAST*>(expr.get());
+    simplify(if_expr->getCond());
+    if (auto* cond = as_number(if_expr->getCond())) {
+      expr_ptr taken = std::move(truth(cond->getVal()) ? if_expr->getThen() : if_expr->getElse());
+      expr = std::move(taken);
+      ++stats.pruned;
+      simplify(expr);
+      break;
+    }
+    simplify(if_expr->getThen());
+    simplify(if_expr->getElse());
+    break;
+  }
+  case ExprAST::Expr_For: {
+    auto* for_expr = static_cast<ast_t::ForExprAST*>(expr.get());
+    simplify(for_expr->getStart());
+    simplify(for_expr->getEnd());
+    simplify(for_expr->getStep());
+    simplify(for_expr->getBody());
+    // the condition is checked before the first iteration
+    if (auto* end = as_number(for_expr->getEnd()); end && !truth(end->getVal())) {
+      expr_ptr start = std::move(for_expr->getStart());
+      source_location_t loc = expr->loc;
+      if (as_number(start)) {
+        expr = make_number(loc, 0.0);
+      }
+      else {
+        // the start value is still evaluated, a compound also yields 0.0
+        std::vector<expr_ptr> statements;
+        statements.push_back(std::move(start));
+        expr = std::make_unique<ast_t::CompoundExprAST>(loc, std::move(statements));
+      }
+      ++stats.pruned;
+    }
+    break;
+  }
+  case ExprAST::Expr_Var:
+    simplify_var(expr);
+    break;
+  case ExprAST::Expr_Compound: {
+    auto& statements = static_cast<ast_t::CompoundExprAST*>(expr.get())->getStatements();
+    for (auto& statement : statements) {
+      simplify(statement);
+    }
+    // a compound always yields 0.0, literal statements do nothing
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < statements.size(); ++i) {
+      if (as_number(statements[i]) || llvm::isa<ast_t::StringExprAST>(statements[i].get())) {
+        ++stats.pruned;
+        continue;
+      }
+      if (kept != i) {
+        statements[kept] = std::move(statements[i]);
+      }
+      ++kept;
+    }
+    statements.resize(kept);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void ast_optimizer_t::simplify_var(expr_ptr& expr) {
+  auto* var = static_cast<ast_t::VarExprAST*>(expr.get());
+  auto& bindings = var->getVarNames();
+  std::vector<bool> removed(bindings.size(), false);
+
+  for (std::size_t i = 0; i < bindings.size(); ++i) {
+    auto& [name, init] = bindings[i];
+    simplify(init);
+    double value = 0.0;
+    if (init) {
+      auto* number = as_number(init);
+      if (!number) {
+        continue;
+      }
+      value = number->getVal();
+    }
+
+    // Later initializers see the binding up to and including one that
+    // rebinds name, the body only if none does.
+    std::size_t last = i + 1;
+    while (last < bindings.size() && bindings[last].first != name) {
+      ++last;
+    }
+    bool reaches_body = last == bindings.size();
+    std::size_t end = reaches_body ? last : last + 1;
+
+    bool assigned = reaches_body && assigns(var->getBody().get(), name);
+    for (std::size_t j = i + 1; j < end && !assigned; ++j) {
+      assigned = assigns(bindings[j].second.get(), name);
+    }
+    if (assigned) {
+      continue;
+    }
+
+    for (std::size_t j = i + 1; j < end; ++j) {
+      substitute(bindings[j].second, name, value);
+    }
+    if (reaches_body) {
+      substitute(var->getBody(), name, value);
+    }
+    removed[i] = true;
+    ++stats.propagated;
+  }
+
+  std::size_t kept = 0;
+  for (std::size_t i = 0; i < bindings.size(); ++i) {
+    if (removed[i]) {
+      continue;
+    }
+    if (kept != i) {
+      bindings[kept] = std::move(bindings[i]);
+    }
+    ++kept;
+  }
+  bindings.resize(kept);
+
+  simplify(var->getBody());
+  if (bindings.empty()) {
+    expr_ptr body = std::move(var->getBody());
+    expr = std::move(body);
+  }
+}
+
+namespace {
+  // pure subtrees of one region, by structural key
+  struct region_t {
+    std::map<std::string, std::vector<expr_ptr*>> occurrences;
+    // set if anything in the region stores to a variable
+    bool assigns = false;
+  };
+}
+
+/// collect - walks the part of a region that always runs, in the scope of
+/// its root. Returns true and fills key if expr is pure, reads is set if it
+/// depends on a variable.
+static bool collect(expr_ptr& expr, const std::set<std::string>& defined, const std::set<std::string>& pure_calls,
+  region_t& region, std::string& key, bool& reads) {
+  reads = false;
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Number: {
+    double value = static_cast<ast_t::NumberExprAST*>(expr.get())->getVal();
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    key = "n" + std::to_string(bits);
+    return true;
+  }
+  case ExprAST::Expr_Variable:
+    key = "v" + static_cast<ast_t::VariableExprAST*>(expr.get())->getName();
+    reads = true;
+    return true;
+  case ExprAST::Expr_Unary: {
+    auto* unary = static_cast<ast_t::UnaryExprAST*>(expr.get());
+    std::string operand;
+    bool pure = collect(unary->getOperand(), defined, pure_calls, region, operand, reads);
+    // user unary operators may call externs
+    if (!pure || (unary->getOpcode() != '-' && unary->getOpcode() != '!')) {
+      return false;
+    }
+    key = std::string("u") + unary->getOpcode() + "(" + operand + ")";
+    break;
+  }
+  case ExprAST::Expr_Binary: {
+    auto* binary = static_cast<ast_t::BinaryExprAST*>(expr.get());
+    if (binary->getOp() == '=') {
+      region.assigns = true;
+      return false;
+    }
+    std::string l, r;
+    bool reads_l, reads_r;
+    bool pure_l = collect(binary->getLHS(), defined, pure_calls, region, l, reads_l);
+    bool pure_r = collect(binary->getRHS(), defined, pure_calls, region, r, reads_r);
+    reads = reads_l || reads_r;
+    if (!pure_l || !pure_r || !is_builtin_binary(binary->getOp())) {
+      return false;
+    }
+    key = std::string("b") + binary->getOp() + "(" + l + "," + r + ")";
+    break;
+  }
+  case ExprAST::Expr_Call: {
+    auto* call = static_cast<ast_t::CallExprAST*>(expr.get());
+    bool pure = is_builtin_call(defined, call->getCallee()) || pure_calls.count(call->getCallee());
+    key = "c" + call->getCallee() + "(";
+    for (auto& arg : call->getArgs()) {
+      std::string arg_key;
+      bool arg_reads;
+      pure = collect(arg, defined, pure_calls, region, arg_key, arg_reads) && pure;
+      reads = reads || arg_reads;
+      key += arg_key + ",";
+    }
+    if (!pure) {
+      return false;
+    }
+    key += ")";
+    break;
+  }
+  case ExprAST::Expr_If: {
+    // only the condition always runs, a store in a branch still ends the region
+    auto* if_expr = static_cast<ast_t::IfExprAST*>(expr.get());
+    std::string cond;
+    bool cond_reads;
+    collect(if_expr->getCond(), defined, pure_calls, region, cond, cond_reads);
+    region.assigns = region.assigns || has_assignment(if_expr->getThen().get()) ||
+      has_assignment(if_expr->getElse().get());
+    return false;
+  }
+  case ExprAST::Expr_For: {
+    auto* for_expr = static_cast<ast_t::ForExprAST*>(expr.get());
+    std::string start;
+    bool start_reads;
+    collect(for_expr->getStart(), defined, pure_calls, region, start, start_reads);
+    region.assigns = region.assigns || has_assignment(for_expr->getEnd().get()) ||
+      has_assignment(for_expr->getStep().get()) || has_assignment(for_expr->getBody().get());
+    return false;
+  }
+  default:
+    // var and compound scopes are regions of their own
+    region.assigns = region.assigns || has_assignment(expr.get());
+    return false;
+  }
+  if (reads) {
+    region.occurrences[key].push_back(&expr);
+  }
+  return true;
+}
+
+bool ast_optimizer_t::eliminate_region(expr_ptr& root) {
+  region_t region;
+  std::string key;
+  bool reads;
+  collect(root, defined, pure_calls, region, key, reads);
+  if (region.assigns) {
+    return false;
+  }
+
+  // Largest repeated subtree first, smaller repeats inside it go with it.
+  std::vector<expr_ptr*>* best = nullptr;
+  std::size_t best_size = 0;
+  for (auto& [candidate, occurrences] : region.occurrences) {
+    if (occurrences.size() > 1 && candidate.size() > best_size) {
+      best = &occurrences;
+      best_size = candidate.size();
+    }
+  }
+  if (!best) {
+    return false;
+  }
+
+  std::string temp = "cse." + std::to_string(next_temp++);
+  expr_ptr init = std::move(*best->front());
+  for (expr_ptr* occurrence : *best) {
+    source_location_t loc = *occurrence ? (*occurrence)->loc : init->loc;
+    *occurrence = std::make_unique<ast_t::VariableExprAST>(loc, temp);
+  }
+
+  std::vector<std::pair<std::string, expr_ptr>> bindings;
+  bindings.emplace_back(temp, std::move(init));
+  source_location_t loc = root->loc;
+  root = std::make_unique<ast_t::VarExprAST>(loc, std::move(bindings), std::move(root));
+  ++stats.cse;
+  return true;
+}
+
+void ast_optimizer_t::eliminate_common(expr_ptr& expr) {
+  if (!expr) {
+    return;
+  }
+  expr_ptr* region = &expr;
+  while (eliminate_region(*region)) {
+    region = &static_cast<ast_t::VarExprAST*>(region->get())->getBody();
+  }
+  eliminate_nested(expr.get());
+}
+
+void ast_optimizer_t::eliminate_nested(ExprAST* expr) {
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Unary:
+  case ExprAST::Expr_Binary:
+  case ExprAST::Expr_Call:
+    for_each_child(expr, [this](expr_ptr& child) {
+      eliminate_nested(child.get());
+    });
+    break;
+  case ExprAST::Expr_If: {
+    auto* if_expr = static_cast<ast_t::IfExprAST*>(expr);
+    eliminate_nested(if_expr->getCond().get());
+    eliminate_common(if_expr->getThen());
+    eliminate_common(if_expr->getElse());
+    break;
+  }
+  case ExprAST::Expr_For: {
+    auto* for_expr = static_cast<ast_t::ForExprAST*>(expr);
+    eliminate_nested(for_expr->getStart().get());
+    eliminate_common(for_expr->getEnd());
+    eliminate_common(for_expr->getStep());
+    eliminate_common(for_expr->getBody());
+    break;
+  }
+  case ExprAST::Expr_Var:
+  case ExprAST::Expr_Compound:
+    for_each_child(expr, [this](expr_ptr& child) {
+      eliminate_common(child);
+    });
+    break;
+  default:
+    break;
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "interpreter.h"
+
+//===----------------------------------------------------------------------===//
+// AST optimizer
+//
+// Runs on the parsed functions before codegen (and before the interpreter
+// binds them), so even -O0 builds hand LLVM less work:
+//  - literal arithmetic and math builtins with literal arguments are folded,
+//  - if/for with constant conditions lose their dead side,
+//  - var bindings with constant initializers that are never assigned are
+//    replaced by the constant,
+//  - repeated pure subexpressions are computed once into a 'cse.N' var,
+//  - calls to pure script functions with literal arguments are run in the
+//    interpreter and replaced by their result. A function is pure when it
+//    only calls builtins and other pure functions, never an extern.
+// Folding follows codegen's semantics (unordered < and >, ordered if/for
+// conditions), so the result is the same with or without the pass.
+//===----------------------------------------------------------------------===//
+
+struct ast_optimizer_t {
+  struct stats_t {
+    uint32_t folded = 0;
+    uint32_t pruned = 0;
+    uint32_t propagated = 0;
+    uint32_t cse = 0;
+    uint32_t evaluated = 0;
+  };
+
+  // compile time evaluation of pure calls, a call that runs out of budget
+  // is left for run time
+  static constexpr uint64_t default_step_budget = 1'000'000;
+  static constexpr uint32_t default_depth_limit = 10'000;
+  // native stack the evaluation may use. Compiles run on threads with as
+  // little as 1 MiB, and an unoptimized build can spend over 1 KiB of it per
+  // script call, so the depth limit alone does not keep it from overflowing.
+  static constexpr std::size_t default_stack_limit = 256 * 1024;
+  bool evaluate_calls = true;
+  uint64_t step_budget = default_step_budget;
+  uint32_t depth_limit = default_depth_limit;
+  std::size_t stack_limit = default_stack_limit;
+
+  // functions declared '@pure', repeated calls to them are merged like
+  // math builtins
+  std::set<std::string> pure_calls;
+
+  /// run - optimizes every function body in place.
+  void run(std::vector<std::unique_ptr<ast_t::FunctionAST>>& functions);
+
+  stats_t stats;
+
+private:
+  using expr_ptr = std::unique_ptr<ast_t::ExprAST>;
+
+  void simplify(expr_ptr& expr);
+  void simplify_var(expr_ptr& expr);
+
+  void find_pure(std::vector<std::unique_ptr<ast_t::FunctionAST>>& functions);
+  // memoized, false if the evaluation failed
+  bool evaluate(const std::string& callee, const std::vector<double>& args, double& result);
+
+  void eliminate_common(expr_ptr& expr);
+  bool eliminate_region(expr_ptr& root);
+  void eliminate_nested(ast_t::ExprAST* expr);
+
+  // names with a script body, they shadow math builtins
+  std::set<std::string> defined;
+  // functions without side effects that take only doubles
+  std::set<std::string> pure;
+  interpreter_t evaluator;
+  // callee and argument bits -> result, nullopt if evaluation failed
+  std::map<std::string, std::optional<double>> evaluated;
+  uint32_t next_temp = 0;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "asset_cache.h"
+
+//===----------------------------------------------------------------------===//
+// Render backends
+//
+// fpp_run_tasks decodes the queued commands and keeps the bookkeeping itself:
+// handle generations, depth order, images by asset id, sprites waiting for
+// their image and which models are loaded (see library.h). A backend only
+// applies the result. Shapes are named by handle slot, images by the id
+// upload_image returned. loco_backend_t draws through fan, recording_backend_t
+// keeps the scene in memory for headless runs, tests and benchmarks.
+//===----------------------------------------------------------------------===//
+
+struct backend_t {
+  enum class print_e {
+    console,
+    standard_output
+  };
+
+  virtual ~backend_t() = default;
+
+  virtual void print(std::string_view text, print_e target) = 0;
+  /// random_color - 0xRRGGBBAA for rectangles created without a color.
+  virtual uint32_t random_color() = 0;
+
+  /// add_rectangle, add_sprite - create the shape of slot, replacing the one
+  /// it held.
+  virtual void add_rectangle(uint32_t slot, double px, double py, double depth, double sx, double sy, uint32_t color, double angle) = 0;
+  virtual void add_sprite(uint32_t slot, uint32_t image, double px, double py, double depth, double sx, double sy, const double (&angle)[3]) = 0;
+  virtual void move_shape(uint32_t slot, double px, double py) = 0;
+  virtual void set_image(uint32_t slot, uint32_t image) = 0;
+  virtual void remove_shape(uint32_t slot) = 0;
+  virtual void clear_shapes() = 0;
+
+  /// decode_image - reads the file at path, called on the asset workers.
+  virtual bool decode_image(const std::string& path, decoded_image_t& image) = 0;
+  virtual uint32_t upload_image(const decoded_image_t& image) = 0;
+  /// load_image - decodes and uploads in one go, for files decode_image
+  /// rejected.
+  virtual uint32_t load_image(const std::string& path) = 0;
+
+  /// load_model - names the file of asset, once per asset.
+  virtual void load_model(uint32_t asset, const std::string& path) = 0;
+  virtual void add_model_instance(uint32_t asset, double px, double py, double pz, double scale) = 0;
+  /// clear_models - removes every instance, a backend may keep what it
+  /// parsed.
+  virtual void clear_models() = 0;
+};
@@ -0,0 +1,72 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#include "run.h"
+#include "codegen.h"
+
+/// compile_one - parses, generates and emits path with a compiler of its own.
+static batch_result_t compile_one(const std::string& path, const batch_options_t& options) {
+  batch_result_t result;
+  result.path = path;
+  auto start = std::chrono::steady_clock::now();
+
+  std::ifstream file(path, std::ios_base::binary);
+  if (!file) {
+    result.error_log = "Error: could not open " + path + "\n";
+    return result;
+  }
+
+  code_t code;
+  code.code_input.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  code.code_input.push_back(EOF);
+  code.source_path = path;
+  // scripts must not overwrite each other's output
+  code.aot.object_path = path + ".o";
+  code.print_ir = false;
+  if (options.configure) {
+    options.configure(code);
+  }
+
+  code.init_code();
+  code.recompile_code();
+
+  result.compiled = code.debug_info.compiled && code.object;
+  result.error_log = code.debug_info.error_log;
+  result.object = code.object;
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+std::vector<batch_result_t> compile_batch(const std::vector<std::string>& paths, const batch_options_t& options) {
+  init_targets();
+
+  std::vector<batch_result_t> results(paths.size());
+  // scripts vary in size, so threads take the next one when they are done
+  // instead of getting a fixed share
+  std::atomic<std::size_t> next{ 0 };
+  auto worker = [&] {
+    for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < paths.size();) {
+      results[i] = compile_one(paths[i], options);
+    }
+  };
+
+  unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = (unsigned)std::min<std::size_t>(threads, paths.size());
+
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : pool) {
+    thread.join();
+  }
+  return results;
+}
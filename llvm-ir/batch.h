@@ -0,0 +1,37 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+
+struct code_t;
+
+//===----------------------------------------------------------------------===//
+// Batch compilation
+//
+// Compiles independent scripts on a pool of threads. Each script gets its own
+// code_t, and with it its own LLVMContext, builder, module and engine, so the
+// only state the threads share is the target registry init_targets fills once.
+//===----------------------------------------------------------------------===//
+
+struct batch_options_t {
+  // 0 runs one thread per core
+  unsigned threads = 0;
+  // called on every compiler before it parses, e.g. to set aot or pgo options
+  std::function<void(code_t&)> configure;
+};
+
+struct batch_result_t {
+  std::string path;
+  bool compiled = false;
+  std::string error_log;
+  // native code of the script, null when it failed to compile
+  std::shared_ptr<const llvm::SmallVector<char, 0>> object;
+  double seconds = 0;
+};
+
+/// compile_batch - compiles every path, results come in the order of paths.
+std::vector<batch_result_t> compile_batch(const std::vector<std::string>& paths, const batch_options_t& options = {});
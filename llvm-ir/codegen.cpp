@@ -1,6 +1,6 @@
 #include "codegen.h"
 
-#include "../include/KaleidoscopeJIT.h"
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
 #include <llvm/ADT/STLExtras.h>
 #include <llvm/Analysis/BasicAliasAnalysis.h>
 #include <llvm/Analysis/Passes.h>
@@ -16,20 +16,19 @@
 #include <llvm/ExecutionEngine/MCJIT.h>
 #include <llvm/ExecutionEngine/Interpreter.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/Passes/PassBuilder.h>
+
+#include <limits>
+#include <mutex>
 
 #include "parser.h"
+#include "math_library.h"
+#include "fpp_string.h"
 
 using namespace llvm;
 using namespace llvm::orc;
 
-ExitOnError ExitOnErr;
-std::map<std::string, AllocaInst*> NamedValues;
-std::unique_ptr<KaleidoscopeJIT> TheJIT;
-
-std::unique_ptr<IRBuilder<>> ir_builder;
-
-std::unique_ptr<LLVMContext> TheContext;
-
 static DISubroutineType* CreateFunctionType(ast_t* ast, unsigned NumArgs) {
   SmallVector<Metadata*, 8> EltTys;
   DIType* DblTy = ast->debug_info.getDoubleTy();
@@ -48,28 +47,52 @@ static DISubroutineType* CreateFunctionType(ast_t* ast, unsigned NumArgs) {
 // Code Generation
 //===----------------------------------------------------------------------===//
 
-void codegen_init() {
-
-  ir_builder = std::unique_ptr<IRBuilder<>>{};
-
-  ExitOnErr = ExitOnError{};
-  NamedValues = std::map<std::string, AllocaInst*>{};
-  TheJIT = std::unique_ptr<KaleidoscopeJIT>{};
-}
-
-void create_the_JIT() {
-  TheJIT = ExitOnErr(KaleidoscopeJIT::Create());
+void init_targets() {
+  // the target registry is process wide, fill it once for every compiler
+  static std::once_flag Once;
+  std::call_once(Once, [] {
+    InitializeAllTargetInfos();
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    InitializeAllAsmParsers();
+    InitializeAllAsmPrinters();
+  });
 }
 
-std::unique_ptr<KaleidoscopeJIT>& get_JIT() {
-  return TheJIT;
+DataLayout host_data_layout() {
+  static const DataLayout Layout = cantFail(cantFail(JITTargetMachineBuilder::detectHost()).getDefaultDataLayoutForTarget());
+  return Layout;
 }
 
-void init_module() {
+void init_module(ast_t* ast) {
   // Open a new module.
-  TheContext = std::make_unique<LLVMContext>();
+  ast->TheContext = std::make_unique<LLVMContext>();
+
+  ast->ir_builder = std::make_unique<IRBuilder<>>(*ast->TheContext);
+  ast->NamedValues.clear();
+}
 
-  ir_builder = std::make_unique<IRBuilder<>>(*TheContext);
+void optimize_module(Module& module, int opt_level, TargetMachine* target_machine) {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  PassBuilder PB(target_machine);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  switch (opt_level) {
+  case 0: MPM = PB.buildO0DefaultPipeline(OptimizationLevel::O0); break;
+  case 1: MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O1); break;
+  case 2: MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O2); break;
+  default: MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O3); break;
+  }
+  MPM.run(module, MAM);
 }
 
 Function* getFunction(ast_t* ast, std::string Name) {
@@ -93,24 +116,385 @@ static AllocaInst* CreateEntryBlockAlloca(Function* TheFunction,
   StringRef VarName) {
   IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
     TheFunction->getEntryBlock().begin());
-  return TmpB.CreateAlloca(Type::getDoubleTy(*TheContext), nullptr, VarName);
+  return TmpB.CreateAlloca(Type::getDoubleTy(TheFunction->getContext()), nullptr, VarName);
+}
+
+/// emit_tier_counter - bumps the tier counter of the function being generated
+/// and calls fpp_tier_up once it reaches the threshold. Used on function
+/// entry and on loop back-edges.
+static void emit_tier_counter(ast_t* ast) {
+  if (ast->tier.current < 0)
+    return;
+  // outside the entry block this is a back-edge
+  Function* Parent = ast->ir_builder->GetInsertBlock()->getParent();
+  if (Parent->getName() == "main" && ast->ir_builder->GetInsertBlock() != &Parent->getEntryBlock())
+    ast->tier.main_loops = true;
+
+  Type* I64Ty = Type::getInt64Ty(*ast->TheContext);
+  Type* I32Ty = Type::getInt32Ty(*ast->TheContext);
+  Type* PtrTy = PointerType::getUnqual(*ast->TheContext);
+  GlobalVariable* Counter = ast->TheModule->getNamedGlobal(ast->tier.functions[ast->tier.current] + ".count");
+
+  Value* Count = ast->ir_builder->CreateLoad(I64Ty, Counter, "tiercount");
+  Value* Next = ast->ir_builder->CreateAdd(Count, ConstantInt::get(I64Ty, 1), "tiernext");
+  ast->ir_builder->CreateStore(Next, Counter);
+  Value* Hot = ast->ir_builder->CreateICmpEQ(Next, ConstantInt::get(I64Ty, ast->tier.threshold), "tierhot");
+
+  Function* TheFunction = ast->ir_builder->GetInsertBlock()->getParent();
+  BasicBlock* TierUpBB = BasicBlock::Create(*ast->TheContext, "tierup", TheFunction);
+  BasicBlock* ContBB = BasicBlock::Create(*ast->TheContext, "tiercont", TheFunction);
+  ast->ir_builder->CreateCondBr(Hot, TierUpBB, ContBB, MDBuilder(*ast->TheContext).createBranchWeights(1, 1 << 20));
+
+  ast->ir_builder->SetInsertPoint(TierUpBB);
+  FunctionCallee TierUp = ast->TheModule->getOrInsertFunction("fpp_tier_up",
+    FunctionType::get(Type::getVoidTy(*ast->TheContext), { PtrTy, I32Ty }, false));
+  // the engine maps the symbol to its tiering_t, the code holds no address
+  GlobalVariable* State = ast->TheModule->getNamedGlobal("fpp.tier.state");
+  if (!State)
+    State = new GlobalVariable(*ast->TheModule, Type::getInt8Ty(*ast->TheContext), false,
+      GlobalValue::ExternalLinkage, nullptr, "fpp.tier.state");
+  ast->ir_builder->CreateCall(TierUp, { State, ConstantInt::get(I32Ty, ast->tier.current) });
+  ast->ir_builder->CreateBr(ContBB);
+
+  ast->ir_builder->SetInsertPoint(ContBB);
+}
+
+/// continue_after_tail - the current block ended in a tail jump or return, the
+/// rest of the enclosing expression goes to a block nothing branches to.
+static Value* continue_after_tail(ast_t* ast) {
+  Function* TheFunction = ast->ir_builder->GetInsertBlock()->getParent();
+  ast->ir_builder->SetInsertPoint(BasicBlock::Create(*ast->TheContext, "aftertail", TheFunction));
+  return PoisonValue::get(Type::getDoubleTy(*ast->TheContext));
+}
+
+/// mark_tail_calls - records the calls of E in tail position. Returned calls
+/// produce the function's result as is; when the body is a compound every path
+/// returns 0.0, so a self call ending it may loop as well.
+static void mark_tail_calls(ast_t* ast, ast_t::ExprAST* E, const ast_t::PrototypeAST& P, bool Returned) {
+  switch (E->getKind()) {
+  case ast_t::ExprAST::Expr_Call: {
+    auto* Call = static_cast<ast_t::CallExprAST*>(E);
+    if (Returned)
+      ast->tail.returned.insert(Call);
+    if (Call->getCallee() == P.getName() && Call->getArgs().size() == P.getArgs().size())
+      ast->tail.self.insert(Call);
+    break;
+  }
+  case ast_t::ExprAST::Expr_If: {
+    auto* If = static_cast<ast_t::IfExprAST*>(E);
+    mark_tail_calls(ast, If->getThen().get(), P, Returned);
+    mark_tail_calls(ast, If->getElse().get(), P, Returned);
+    break;
+  }
+  case ast_t::ExprAST::Expr_Var:
+    mark_tail_calls(ast, static_cast<ast_t::VarExprAST*>(E)->getBody().get(), P, Returned);
+    break;
+  case ast_t::ExprAST::Expr_Compound: {
+    auto& Statements = static_cast<ast_t::CompoundExprAST*>(E)->getStatements();
+    if (ast->tail.zero_result && !Statements.empty())
+      mark_tail_calls(ast, Statements.back().get(), P, false);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+/// emit_memo_wrapper - fills Wrapper with a lookup in a flat open addressing
+/// table keyed by the bits of its arguments, Impl computes missing results.
+/// Probing stops after memo.max_probes slots, the result is then returned
+/// without being cached.
+static void emit_memo_wrapper(ast_t* ast, Function* Wrapper, Function* Impl, uint32_t Capacity) {
+  std::string Name = Wrapper->getName().str();
+  Module& M = *ast->TheModule;
+  unsigned Arity = Wrapper->arg_size();
+  unsigned KeyWidth = std::max(Arity, 1u);
+  Type* I64Ty = Type::getInt64Ty(*ast->TheContext);
+  Type* I8Ty = Type::getInt8Ty(*ast->TheContext);
+  Type* DoubleTy = Type::getDoubleTy(*ast->TheContext);
+
+  auto CreateTable = [&](Type* Ty, const std::string& Suffix) {
+    return new GlobalVariable(M, Ty, false, GlobalValue::ExternalLinkage, Constant::getNullValue(Ty), ast->scoped(Name + Suffix));
+  };
+  ArrayType* KeysTy = ArrayType::get(I64Ty, uint64_t(Capacity) * KeyWidth);
+  ArrayType* ValuesTy = ArrayType::get(DoubleTy, Capacity);
+  ArrayType* UsedTy = ArrayType::get(I8Ty, Capacity);
+  GlobalVariable* Keys = CreateTable(KeysTy, ".memo.keys");
+  GlobalVariable* Values = CreateTable(ValuesTy, ".memo.values");
+  GlobalVariable* Used = CreateTable(UsedTy, ".memo.used");
+  GlobalVariable* Hits = CreateTable(I64Ty, ".memo.hits");
+  GlobalVariable* Misses = CreateTable(I64Ty, ".memo.misses");
+
+  // a builder of its own, the wrapper has no debug info or fast-math
+  BasicBlock* EntryBB = BasicBlock::Create(*ast->TheContext, "entry", Wrapper);
+  BasicBlock* ProbeBB = BasicBlock::Create(*ast->TheContext, "probe", Wrapper);
+  BasicBlock* CompareBB = BasicBlock::Create(*ast->TheContext, "compare", Wrapper);
+  BasicBlock* NextBB = BasicBlock::Create(*ast->TheContext, "next", Wrapper);
+  BasicBlock* HitBB = BasicBlock::Create(*ast->TheContext, "hit", Wrapper);
+  BasicBlock* FillBB = BasicBlock::Create(*ast->TheContext, "fill", Wrapper);
+  BasicBlock* MissBB = BasicBlock::Create(*ast->TheContext, "miss", Wrapper);
+  IRBuilder<> B(EntryBB);
+
+  // FNV-1a over the argument bits, small integers only differ in the high
+  // bits so a murmur3 finalizer mixes them down into the index
+  std::vector<Value*> Args;
+  std::vector<Value*> Bits;
+  Value* Hash = B.getInt64(0xcbf29ce484222325ull);
+  for (auto& Arg : Wrapper->args()) {
+    Args.push_back(&Arg);
+    Bits.push_back(B.CreateBitCast(&Arg, I64Ty, Arg.getName() + ".bits"));
+    Hash = B.CreateMul(B.CreateXor(Hash, Bits.back()), B.getInt64(0x100000001b3ull));
+  }
+  Hash = B.CreateXor(Hash, B.CreateLShr(Hash, 33));
+  Hash = B.CreateMul(Hash, B.getInt64(0xff51afd7ed558ccdull));
+  Hash = B.CreateXor(Hash, B.CreateLShr(Hash, 33));
+  Hash = B.CreateMul(Hash, B.getInt64(0xc4ceb9fe1a85ec53ull));
+  Hash = B.CreateXor(Hash, B.CreateLShr(Hash, 33), "hash");
+  Value* Mask = B.getInt64(Capacity - 1);
+  Value* Start = B.CreateAnd(Hash, Mask);
+  B.CreateBr(ProbeBB);
+
+  B.SetInsertPoint(ProbeBB);
+  PHINode* Index = B.CreatePHI(I64Ty, 2, "index");
+  PHINode* Probes = B.CreatePHI(I64Ty, 2, "probes");
+  Index->addIncoming(Start, EntryBB);
+  Probes->addIncoming(B.getInt64(0), EntryBB);
+  Value* UsedPtr = B.CreateInBoundsGEP(UsedTy, Used, { B.getInt64(0), Index });
+  Value* IsUsed = B.CreateICmpNE(B.CreateLoad(I8Ty, UsedPtr), B.getInt8(0), "isused");
+  B.CreateCondBr(IsUsed, CompareBB, FillBB);
+
+  B.SetInsertPoint(CompareBB);
+  Value* KeyBase = B.CreateMul(Index, B.getInt64(KeyWidth));
+  Value* Same = B.getTrue();
+  for (unsigned i = 0; i < Arity; ++i) {
+    Value* KeyPtr = B.CreateInBoundsGEP(KeysTy, Keys, { B.getInt64(0), B.CreateAdd(KeyBase, B.getInt64(i)) });
+    Same = B.CreateAnd(Same, B.CreateICmpEQ(B.CreateLoad(I64Ty, KeyPtr), Bits[i]));
+  }
+  B.CreateCondBr(Same, HitBB, NextBB);
+
+  B.SetInsertPoint(NextBB);
+  Value* NextIndex = B.CreateAnd(B.CreateAdd(Index, B.getInt64(1)), Mask);
+  Value* NextProbes = B.CreateAdd(Probes, B.getInt64(1));
+  Index->addIncoming(NextIndex, NextBB);
+  Probes->addIncoming(NextProbes, NextBB);
+  B.CreateCondBr(B.CreateICmpULT(NextProbes, B.getInt64(ast->memo.max_probes)), ProbeBB, MissBB);
+
+  auto Increment = [&](GlobalVariable* Counter) {
+    B.CreateStore(B.CreateAdd(B.CreateLoad(I64Ty, Counter), B.getInt64(1)), Counter);
+  };
+
+  B.SetInsertPoint(HitBB);
+  Increment(Hits);
+  B.CreateRet(B.CreateLoad(DoubleTy, B.CreateInBoundsGEP(ValuesTy, Values, { B.getInt64(0), Index })));
+
+  // A recursive call may have taken the free slot meanwhile, the newer
+  // entry wins, it is only a cache.
+  B.SetInsertPoint(FillBB);
+  Increment(Misses);
+  CallInst* Result = B.CreateCall(Impl, Args, "result");
+  Result->setCallingConv(Impl->getCallingConv());
+  KeyBase = B.CreateMul(Index, B.getInt64(KeyWidth));
+  for (unsigned i = 0; i < Arity; ++i)
+    B.CreateStore(Bits[i], B.CreateInBoundsGEP(KeysTy, Keys, { B.getInt64(0), B.CreateAdd(KeyBase, B.getInt64(i)) }));
+  B.CreateStore(Result, B.CreateInBoundsGEP(ValuesTy, Values, { B.getInt64(0), Index }));
+  B.CreateStore(B.getInt8(1), UsedPtr);
+  B.CreateRet(Result);
+
+  B.SetInsertPoint(MissBB);
+  Increment(Misses);
+  Result = B.CreateCall(Impl, Args, "result");
+  Result->setCallingConv(Impl->getCallingConv());
+  B.CreateRet(Result);
+}
+
+/// pgo_counter_name - global holding counter slot of function.
+static std::string pgo_counter_name(ast_t* ast, const std::string& function, uint32_t slot) {
+  return ast->scoped("fpp.prof." + function + "." + std::to_string(slot));
+}
+
+/// pgo_reserve - reserves count counter slots for the current function. The
+/// order only depends on the source, so generate and use builds agree.
+static uint32_t pgo_reserve(ast_t* ast, uint32_t count) {
+  uint32_t slot = ast->pgo.next_counter;
+  ast->pgo.next_counter += count;
+  return slot;
+}
+
+/// emit_pgo_increment - counts one execution of the current insert point.
+static void emit_pgo_increment(ast_t* ast, uint32_t slot) {
+  if (ast->pgo.mode != ast_t::pgo_info_t::generate)
+    return;
+
+  Type* I64Ty = Type::getInt64Ty(*ast->TheContext);
+  std::string Name = pgo_counter_name(ast, ast->pgo.function, slot);
+  GlobalVariable* Counter = ast->TheModule->getNamedGlobal(Name);
+  if (!Counter) {
+    Counter = new GlobalVariable(*ast->TheModule, I64Ty, false, GlobalValue::ExternalLinkage,
+      ConstantInt::get(I64Ty, 0), Name);
+    ast->pgo.counters.emplace_back(ast->pgo.function, slot);
+  }
+  Value* Count = ast->ir_builder->CreateLoad(I64Ty, Counter, "profcount");
+  ast->ir_builder->CreateStore(ast->ir_builder->CreateAdd(Count, ConstantInt::get(I64Ty, 1)), Counter);
+}
+
+/// pgo_profile_count - recorded count of slot in the current function.
+static uint64_t pgo_profile_count(ast_t* ast, uint32_t slot) {
+  auto found = ast->pgo.profile.find(ast->pgo.function);
+  if (found == ast->pgo.profile.end() || slot >= found->second.size())
+    return 0;
+  return found->second[slot];
+}
+
+/// pgo_branch_weights - taken/not taken weights for the branch site starting
+/// at slot, null when no profile is applied.
+static MDNode* pgo_branch_weights(ast_t* ast, uint32_t slot) {
+  if (ast->pgo.mode != ast_t::pgo_info_t::use)
+    return nullptr;
+  auto clamp = [](uint64_t count) {
+    return (uint32_t)std::min<uint64_t>(count, std::numeric_limits<uint32_t>::max());
+  };
+  return MDBuilder(*ast->TheContext).createBranchWeights(
+    clamp(pgo_profile_count(ast, slot)), clamp(pgo_profile_count(ast, slot + 1)));
+}
+
+/// pgo_weigh - gives Branch the weights of the site at slot, or Fallback when
+/// no profile is applied.
+static void pgo_weigh(ast_t* ast, Instruction* Branch, uint32_t slot, MDNode* Fallback) {
+  MDNode* Weights = pgo_branch_weights(ast, slot);
+  if (!Weights) {
+    Branch->setMetadata(LLVMContext::MD_prof, Fallback);
+    return;
+  }
+  Branch->setMetadata(LLVMContext::MD_prof, Weights);
+  ast->pgo.weighted.emplace_back(Branch, Fallback);
+}
+
+/// pgo_apply_entry - checks the current function's profile entry against
+/// the counters codegen reserved, then applies its entry count and hot/cold
+/// attributes. A mismatch undoes the branch weights instead.
+static void pgo_apply_entry(ast_t* ast, Function* TheFunction, const ast_t::PrototypeAST& P) {
+  auto Weighted = std::move(ast->pgo.weighted);
+  ast->pgo.weighted.clear();
+  if (ast->pgo.mode == ast_t::pgo_info_t::generate)
+    ast->pgo.slots[ast->pgo.function] = ast->pgo.next_counter;
+  if (ast->pgo.mode != ast_t::pgo_info_t::use)
+    return;
+
+  auto found = ast->pgo.profile.find(ast->pgo.function);
+  if (found == ast->pgo.profile.end() || found->second.size() != ast->pgo.next_counter) {
+    for (auto& [Branch, Fallback] : Weighted)
+      Branch->setMetadata(LLVMContext::MD_prof, Fallback);
+    ++ast->pgo.rejected;
+    return;
+  }
+
+  uint64_t Entries = pgo_profile_count(ast, 0);
+  TheFunction->setEntryCount(Entries);
+  // '@hot', '@cold' and '@noinline' written by hand win over the profile
+  bool Hinted = P.getAttribute("hot") || P.getAttribute("cold") || P.getAttribute("noinline");
+  if (Hinted) {
+    // keep the hint
+  }
+  else if (Entries == 0) {
+    TheFunction->addFnAttr(Attribute::Cold);
+  }
+  else if (Entries >= ast->pgo.hot_count) {
+    TheFunction->addFnAttr(Attribute::Hot);
+    TheFunction->addFnAttr(Attribute::InlineHint);
+  }
+}
+
+/// hint_branch_weights - weights for '@likely'/'@unlikely' on an if, null
+/// without either.
+static MDNode* hint_branch_weights(ast_t* ast, const ast_t::ExprAST* If) {
+  if (If->getAttribute("likely"))
+    return MDBuilder(*ast->TheContext).createLikelyBranchWeights();
+  if (If->getAttribute("unlikely"))
+    return MDBuilder(*ast->TheContext).createUnlikelyBranchWeights();
+  return nullptr;
+}
+
+/// loop_metadata - llvm.loop hints for '@unroll', '@unroll(N)', '@nounroll'
+/// and '@vectorize(N)', null without any.
+static MDNode* loop_metadata(ast_t* ast, const ast_t::ExprAST* Loop) {
+  SmallVector<Metadata*, 4> Ops;
+  Ops.push_back(nullptr); // the loop id refers to itself
+  auto AddHint = [ast, &Ops](StringRef Name, Metadata* Value) {
+    SmallVector<Metadata*, 2> Hint{ MDString::get(*ast->TheContext, Name) };
+    if (Value)
+      Hint.push_back(Value);
+    Ops.push_back(MDNode::get(*ast->TheContext, Hint));
+  };
+  auto Count = [ast](double Value) {
+    return ConstantAsMetadata::get(ConstantInt::get(Type::getInt32Ty(*ast->TheContext), (uint32_t)Value));
+  };
+
+  for (const auto& Attr : Loop->getAttributes()) {
+    if (Attr.name == "unroll") {
+      if (Attr.has_value)
+        AddHint("llvm.loop.unroll.count", Count(Attr.value));
+      else
+        AddHint("llvm.loop.unroll.enable", nullptr);
+    }
+    else if (Attr.name == "nounroll") {
+      AddHint("llvm.loop.unroll.disable", nullptr);
+    }
+    else if (Attr.name == "vectorize") {
+      AddHint("llvm.loop.vectorize.enable", ConstantAsMetadata::get(ConstantInt::getTrue(*ast->TheContext)));
+      if (Attr.has_value)
+        AddHint("llvm.loop.vectorize.width", Count(Attr.value));
+    }
+  }
+  if (Ops.size() == 1)
+    return nullptr;
+
+  MDNode* LoopID = MDNode::getDistinct(*ast->TheContext, Ops);
+  LoopID->replaceOperandWith(0, LoopID);
+  return LoopID;
 }
 
 Value* ast_t::NumberExprAST::codegen(ast_t* ast) {
   ast->debug_info.emit_location(this);
-  return ConstantFP::get(*TheContext, APFloat(Val));
+  return ConstantFP::get(*ast->TheContext, APFloat(Val));
+}
+
+Value* ast_t::StringExprAST::codegen(ast_t* ast) {
+  // every occurrence of a literal shares one fpp_string_t, see fpp_string.h
+  GlobalVariable*& Pooled = ast->string_pool[Val];
+  if (Pooled)
+    return Pooled;
+
+  LLVMContext& Context = *ast->TheContext;
+  Type* I64Ty = Type::getInt64Ty(Context);
+
+  Constant* Chars = ConstantDataArray::getString(Context, Val);
+  auto* Data = new GlobalVariable(*ast->TheModule, Chars->getType(), true,
+    GlobalValue::PrivateLinkage, Chars, "str.data");
+  Data->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  Data->setAlignment(Align(1));
+
+  StructType* StringTy = StructType::get(Context, { PointerType::getUnqual(Context), I64Ty, I64Ty });
+  Constant* String = ConstantStruct::get(StringTy, {
+    Data,
+    ConstantInt::get(I64Ty, Val.size()),
+    ConstantInt::get(I64Ty, fpp_hash(Val.data(), Val.size()))
+  });
+  Pooled = new GlobalVariable(*ast->TheModule, StringTy, true,
+    GlobalValue::PrivateLinkage, String, "str");
+  Pooled->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+  return Pooled;
 }
 
 Value* ast_t::VariableExprAST::codegen(ast_t* ast) {
   // Look this variable up in the function.
-  Value* V = NamedValues[Name];
+  Value* V = ast->NamedValues[Name];
   if (!V)
     return ast->debug_info.LogErrorV(this->loc, "Unknown variable name");
 
   ast->debug_info.emit_location(this);
   // Load the value.
   // PointerType::getUnqual(i8*)
-  return ir_builder->CreateLoad(Type::getDoubleTy(*TheContext), V, Name.c_str());
+  return ast->ir_builder->CreateLoad(Type::getDoubleTy(*ast->TheContext), V, Name.c_str());
 }
 
 Value* ast_t::UnaryExprAST::codegen(ast_t* ast) {
@@ -121,16 +505,16 @@ Value* ast_t::UnaryExprAST::codegen(ast_t* ast) {
   switch (Opcode) {
     case '!': {
       Value* Zero = ConstantFP::get(OperandV->getType(), 0.0);
-      Value* Cmp = ir_builder->CreateFCmpOEQ(OperandV, Zero, "cmptmp");
-      return ir_builder->CreateUIToFP(Cmp, Type::getDoubleTy(*TheContext), "booltmp");
+      Value* Cmp = ast->ir_builder->CreateFCmpOEQ(OperandV, Zero, "cmptmp");
+      return ast->ir_builder->CreateUIToFP(Cmp, Type::getDoubleTy(*ast->TheContext), "booltmp");
     }
     case '&': {
       Value* One = ConstantFP::get(OperandV->getType(), 1.0);
-      Value* AndResult = ir_builder->CreateAnd(OperandV, One, "andtmp");
-      return ir_builder->CreateUIToFP(AndResult, Type::getDoubleTy(*TheContext), "booltmp");
+      Value* AndResult = ast->ir_builder->CreateAnd(OperandV, One, "andtmp");
+      return ast->ir_builder->CreateUIToFP(AndResult, Type::getDoubleTy(*ast->TheContext), "booltmp");
     }
     case '-': {
-      Value* Neg = ir_builder->CreateFNeg(OperandV, "negtmp"); return Neg;
+      Value* Neg = ast->ir_builder->CreateFNeg(OperandV, "negtmp"); return Neg;
     }
   }
 
@@ -139,7 +523,7 @@ Value* ast_t::UnaryExprAST::codegen(ast_t* ast) {
      return ast->debug_info.LogErrorV(this->loc, "Unknown unary operator");
 
   ast->debug_info.emit_location(this);
-  return ir_builder->CreateCall(F, OperandV, "unop");
+  return ast->ir_builder->CreateCall(F, OperandV, "unop");
 }
 
 Value* ast_t::BinaryExprAST::codegen(ast_t* ast) {
@@ -160,11 +544,11 @@ Value* ast_t::BinaryExprAST::codegen(ast_t* ast) {
       return nullptr;
 
     // Look up the name.
-    Value* Variable = NamedValues[LHSE->getName()];
+    Value* Variable = ast->NamedValues[LHSE->getName()];
     if (!Variable)
       return ast->debug_info.LogErrorV(this->loc, "Unknown variable name");
 
-    ir_builder->CreateStore(Val, Variable);
+    ast->ir_builder->CreateStore(Val, Variable);
     return Val;
   }
 
@@ -175,28 +559,28 @@ Value* ast_t::BinaryExprAST::codegen(ast_t* ast) {
 
   switch (Op) {
   case '+':
-    return ir_builder->CreateFAdd(L, R, "addtmp");
+    return ast->ir_builder->CreateFAdd(L, R, "addtmp");
   case '-':
-    return ir_builder->CreateFSub(L, R, "subtmp");
+    return ast->ir_builder->CreateFSub(L, R, "subtmp");
   case '*':
-    return ir_builder->CreateFMul(L, R, "multmp");
-  case '/': return ir_builder->CreateFDiv(L, R, "divtmp");
+    return ast->ir_builder->CreateFMul(L, R, "multmp");
+  case '/': return ast->ir_builder->CreateFDiv(L, R, "divtmp");
   case '<':
-    L = ir_builder->CreateFCmpULT(L, R, "cmptmp");
-    return ir_builder->CreateUIToFP(L, Type::getDoubleTy(*TheContext), "booltmp");
+    L = ast->ir_builder->CreateFCmpULT(L, R, "cmptmp");
+    return ast->ir_builder->CreateUIToFP(L, Type::getDoubleTy(*ast->TheContext), "booltmp");
   case '>':
-    L = ir_builder->CreateFCmpUGT(L, R, "cmptmp");
-    return ir_builder->CreateUIToFP(L, Type::getDoubleTy(*TheContext), "booltmp");
+    L = ast->ir_builder->CreateFCmpUGT(L, R, "cmptmp");
+    return ast->ir_builder->CreateUIToFP(L, Type::getDoubleTy(*ast->TheContext), "booltmp");
   case '%': {
     if (L->getType()->isIntegerTy() && R->getType()->isIntegerTy()) {
-      return ir_builder->CreateSRem(L, R, "modtmp");
+      return ast->ir_builder->CreateSRem(L, R, "modtmp");
     }
     else if (L->getType()->isFloatingPointTy() && R->getType()->isFloatingPointTy()) {
-      Function* FloorF = Intrinsic::getDeclaration(ast->TheModule.get(), Intrinsic::floor, Type::getDoubleTy(*TheContext));
-      Value* Div = ir_builder->CreateFDiv(L, R, "divtmp");
-      Value* FloorDiv = ir_builder->CreateCall(FloorF, { Div }, "floordivtmp");
-      Value* Mult = ir_builder->CreateFMul(FloorDiv, R, "multtmp");
-      return ir_builder->CreateFSub(L, Mult, "modtmp");
+      Function* FloorF = Intrinsic::getDeclaration(ast->TheModule.get(), Intrinsic::floor, Type::getDoubleTy(*ast->TheContext));
+      Value* Div = ast->ir_builder->CreateFDiv(L, R, "divtmp");
+      Value* FloorDiv = ast->ir_builder->CreateCall(FloorF, { Div }, "floordivtmp");
+      Value* Mult = ast->ir_builder->CreateFMul(FloorDiv, R, "multtmp");
+      return ast->ir_builder->CreateFSub(L, Mult, "modtmp");
     }
     else {
       return ast->debug_info.LogErrorV(this->loc, "Operands to % must be both integers or both floats.");
@@ -205,26 +589,26 @@ Value* ast_t::BinaryExprAST::codegen(ast_t* ast) {
   case '|': {
     if (L->getType()->isFloatingPointTy() && R->getType()->isFloatingPointTy()) {
       Value* Zero = ConstantFP::get(L->getType(), 0.0);
-      L = ir_builder->CreateFCmpUNE(L, Zero, "cmpL");
-      R = ir_builder->CreateFCmpUNE(R, Zero, "cmpR");
-      Value* OrResult = ir_builder->CreateOr(L, R, "ortmp");
-      return ir_builder->CreateUIToFP(OrResult, Type::getDoubleTy(*TheContext), "booltmp");
+      L = ast->ir_builder->CreateFCmpUNE(L, Zero, "cmpL");
+      R = ast->ir_builder->CreateFCmpUNE(R, Zero, "cmpR");
+      Value* OrResult = ast->ir_builder->CreateOr(L, R, "ortmp");
+      return ast->ir_builder->CreateUIToFP(OrResult, Type::getDoubleTy(*ast->TheContext), "booltmp");
     }
     else {
-      return ir_builder->CreateOr(L, R, "ortmp");
+      return ast->ir_builder->CreateOr(L, R, "ortmp");
     }
   }
   case '&': {
     if (L->getType()->isFloatingPointTy() && R->getType()->isFloatingPointTy()) {
       // Compare if both are non-zero (considering floating-point values)
       Value* Zero = ConstantFP::get(L->getType(), 0.0);
-      L = ir_builder->CreateFCmpUNE(L, Zero, "cmpL");
-      R = ir_builder->CreateFCmpUNE(R, Zero, "cmpR");
-      Value* AndResult = ir_builder->CreateAnd(L, R, "andtmp");
-      return ir_builder->CreateUIToFP(AndResult, Type::getDoubleTy(*TheContext), "booltmp");
+      L = ast->ir_builder->CreateFCmpUNE(L, Zero, "cmpL");
+      R = ast->ir_builder->CreateFCmpUNE(R, Zero, "cmpR");
+      Value* AndResult = ast->ir_builder->CreateAnd(L, R, "andtmp");
+      return ast->ir_builder->CreateUIToFP(AndResult, Type::getDoubleTy(*ast->TheContext), "booltmp");
     }
     else {
-      return ir_builder->CreateAnd(L, R, "andtmp");
+      return ast->ir_builder->CreateAnd(L, R, "andtmp");
     }
   }
   default:
@@ -237,12 +621,75 @@ Value* ast_t::BinaryExprAST::codegen(ast_t* ast) {
   assert(F && "binary operator not found!");
 
   Value* Ops[] = { L, R };
-  return ir_builder->CreateCall(F, Ops, "binop");
+  return ast->ir_builder->CreateCall(F, Ops, "binop");
+}
+
+/// emit_math_builtin - lowers a call to the built-in math library into the
+/// matching llvm.* intrinsic.
+static Value* emit_math_builtin(ast_t* ast, const math_builtin_t& builtin, const std::vector<Value*>& ArgsV) {
+  Type* DoubleTy = Type::getDoubleTy(*ast->TheContext);
+  Function* F = Intrinsic::getDeclaration(ast->TheModule.get(), builtin.id, DoubleTy);
+  return ast->ir_builder->CreateCall(F, ArgsV, "mathtmp");
+}
+
+/// emit_asset - the fpp_asset_t* passed to an 'asset' parameter of Callee. A
+/// literal path becomes an entry of the module's asset table, any other string
+/// is resolved by fpp_asset on every call. See asset_table.h.
+static Value* emit_asset(ast_t* ast, const std::string& Callee, ast_t::ExprAST* Arg, const source_location_t& Loc) {
+  LLVMContext& Context = *ast->TheContext;
+  Type* PtrTy = PointerType::getUnqual(Context);
+
+  if (auto* Literal = dyn_cast<ast_t::StringExprAST>(Arg)) {
+    GlobalVariable*& Asset = ast->asset_pool[Literal->getVal()];
+    if (Asset)
+      return Asset;
+
+    Type* I32Ty = Type::getInt32Ty(Context);
+    StructType* AssetTy = StructType::get(Context, { PtrTy, I32Ty });
+    auto* Path = cast<Constant>(Literal->codegen(ast));
+    // writable, the first call stores the id
+    Asset = new GlobalVariable(*ast->TheModule, AssetTy, false, GlobalValue::PrivateLinkage,
+      ConstantStruct::get(AssetTy, { Path, ConstantInt::get(I32Ty, 0) }), "asset");
+    // the file loads while the rest of the module compiles
+    if (ast->prefetch_asset)
+      ast->prefetch_asset(Callee, Literal->getVal());
+    return Asset;
+  }
+
+  Value* Path = Arg->codegen(ast);
+  if (!Path)
+    return nullptr;
+  if (!Path->getType()->isPointerTy())
+    return ast->debug_info.LogErrorV(Loc, "Expected a path for the asset argument of " + Callee);
+
+  Function* Resolve = ast->TheModule->getFunction("fpp_asset");
+  if (!Resolve)
+    Resolve = Function::Create(FunctionType::get(PtrTy, { PtrTy }, false),
+      Function::ExternalLinkage, "fpp_asset", ast->TheModule.get());
+  return ast->ir_builder->CreateCall(Resolve, { Path }, "asset");
 }
 
 Value* ast_t::CallExprAST::codegen(ast_t* ast) {
   ast->debug_info.emit_location(this);
 
+  // Math builtins become intrinsics unless the script defines its own body.
+  if (auto* builtin = find_math_builtin(Callee)) {
+    if (!ast->script_defs.count(Callee)) {
+      if (builtin->arity != Args.size())
+        return ast->debug_info.LogErrorV(this->loc, "Incorrect # arguments passed to " + Callee);
+
+      std::vector<Value*> ArgsV;
+      for (auto& Arg : Args) {
+        ArgsV.push_back(Arg->codegen(ast));
+        if (!ArgsV.back())
+          return nullptr;
+        if (!ArgsV.back()->getType()->isDoubleTy())
+          return ast->debug_info.LogErrorV(this->loc, "Expected double argument to " + Callee);
+      }
+      return emit_math_builtin(ast, *builtin, ArgsV);
+    }
+  }
+
   // Look up the name in the global module table.
   Function* CalleeF = getFunction(ast, Callee);
   if (!CalleeF)
@@ -252,14 +699,60 @@ Value* ast_t::CallExprAST::codegen(ast_t* ast) {
   if (CalleeF->arg_size() != Args.size())
     return ast->debug_info.LogErrorV(this->loc, "Incorrect # arguments passed");
 
+  const PrototypeAST* Proto = nullptr;
+  if (auto FI = ast->FunctionProtos.find(Callee); FI != ast->FunctionProtos.end())
+    Proto = FI->second.get();
+
   std::vector<Value*> ArgsV;
   for (unsigned i = 0, e = Args.size(); i != e; ++i) {
-    ArgsV.push_back(Args[i]->codegen(ast));
+    if (Proto && Proto->getArgTypes()[i] == "asset")
+      ArgsV.push_back(emit_asset(ast, Callee, Args[i].get(), this->loc));
+    else
+      ArgsV.push_back(Args[i]->codegen(ast));
     if (!ArgsV.back())
       return nullptr;
   }
 
-  return ir_builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  // A self call in tail position reuses the frame: the new arguments replace
+  // the old ones and control goes back to the top of the function.
+  if (ast->tail.self.count(this)) {
+    for (unsigned i = 0, e = ArgsV.size(); i != e; ++i)
+      ast->ir_builder->CreateStore(ArgsV[i], ast->tail.args[i]);
+    emit_tier_counter(ast);
+    ast->ir_builder->CreateBr(ast->tail.header);
+    return continue_after_tail(ast);
+  }
+
+  // '@tail' guarantees the call does not grow the stack, LLVM requires the
+  // callee to match the caller and the call to be returned right away.
+  bool MustTail = getAttribute("tail") != nullptr;
+  if (MustTail) {
+    Function* Caller = ast->ir_builder->GetInsertBlock()->getParent();
+    if (!ast->tail.returned.count(this))
+      return ast->debug_info.LogErrorV(this->loc, "'@tail' call to " + Callee + " is not in tail position");
+    if (CalleeF->getFunctionType() != Caller->getFunctionType() || CalleeF->getCallingConv() != Caller->getCallingConv())
+      return ast->debug_info.LogErrorV(this->loc, "'@tail' callee " + Callee + " does not match the signature of " + Caller->getName().str());
+  }
+
+  CallInst* Call;
+  // Tiered functions are called through their slot so tier-up can patch them.
+  if (ast->tier.index.count(Callee)) {
+    GlobalVariable* Slot = ast->TheModule->getNamedGlobal(Callee + ".slot");
+    LoadInst* Target = ast->ir_builder->CreateLoad(PointerType::getUnqual(*ast->TheContext), Slot, "tiertarget");
+    Target->setAtomic(AtomicOrdering::Monotonic);
+    Call = ast->ir_builder->CreateCall(CalleeF->getFunctionType(), Target, ArgsV, "calltmp");
+  }
+  else {
+    Call = ast->ir_builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  }
+
+  if (!MustTail)
+    return Call;
+
+  Call->setTailCallKind(CallInst::TCK_MustTail);
+  Call->setCallingConv(CalleeF->getCallingConv());
+  ast->ir_builder->CreateRet(Call);
+  return continue_after_tail(ast);
 }
 
 Value* ast_t::IfExprAST::codegen(ast_t* ast) {
@@ -270,46 +763,50 @@ Value* ast_t::IfExprAST::codegen(ast_t* ast) {
     return nullptr;
 
   // Convert condition to a bool by comparing non-equal to 0.0.
-  CondV = ir_builder->CreateFCmpONE(
-    CondV, ConstantFP::get(*TheContext, APFloat(0.0)), "ifcond");
+  CondV = ast->ir_builder->CreateFCmpONE(
+    CondV, ConstantFP::get(*ast->TheContext, APFloat(0.0)), "ifcond");
 
-  Function* TheFunction = ir_builder->GetInsertBlock()->getParent();
+  Function* TheFunction = ast->ir_builder->GetInsertBlock()->getParent();
 
   // Create blocks for the then and else cases.  Insert the 'then' block at the
   // end of the function.
-  BasicBlock* ThenBB = BasicBlock::Create(*TheContext, "then", TheFunction);
-  BasicBlock* ElseBB = BasicBlock::Create(*TheContext, "else");
-  BasicBlock* MergeBB = BasicBlock::Create(*TheContext, "ifcont");
+  BasicBlock* ThenBB = BasicBlock::Create(*ast->TheContext, "then", TheFunction);
+  BasicBlock* ElseBB = BasicBlock::Create(*ast->TheContext, "else");
+  BasicBlock* MergeBB = BasicBlock::Create(*ast->TheContext, "ifcont");
 
-  ir_builder->CreateCondBr(CondV, ThenBB, ElseBB);
+  // a recorded profile beats a hint
+  uint32_t ProfSlot = pgo_reserve(ast, 2);
+  pgo_weigh(ast, ast->ir_builder->CreateCondBr(CondV, ThenBB, ElseBB), ProfSlot, hint_branch_weights(ast, this));
 
   // Emit then value.
-  ir_builder->SetInsertPoint(ThenBB);
+  ast->ir_builder->SetInsertPoint(ThenBB);
+  emit_pgo_increment(ast, ProfSlot);
 
   Value* ThenV = Then->codegen(ast);
   if (!ThenV)
     return nullptr;
 
-  ir_builder->CreateBr(MergeBB);
+  ast->ir_builder->CreateBr(MergeBB);
   // Codegen of 'Then' can change the current block, update ThenBB for the PHI.
-  ThenBB = ir_builder->GetInsertBlock();
+  ThenBB = ast->ir_builder->GetInsertBlock();
 
   // Emit else block.
   TheFunction->insert(TheFunction->end(), ElseBB);
-  ir_builder->SetInsertPoint(ElseBB);
+  ast->ir_builder->SetInsertPoint(ElseBB);
+  emit_pgo_increment(ast, ProfSlot + 1);
 
   Value* ElseV = Else->codegen(ast);
   if (!ElseV)
     return nullptr;
 
-  ir_builder->CreateBr(MergeBB);
+  ast->ir_builder->CreateBr(MergeBB);
   // Codegen of 'Else' can change the current block, update ElseBB for the PHI.
-  ElseBB = ir_builder->GetInsertBlock();
+  ElseBB = ast->ir_builder->GetInsertBlock();
 
   // Emit merge block.
   TheFunction->insert(TheFunction->end(), MergeBB);
-  ir_builder->SetInsertPoint(MergeBB);
-  PHINode* PN = ir_builder->CreatePHI(Type::getDoubleTy(*TheContext), 2, "iftmp");
+  ast->ir_builder->SetInsertPoint(MergeBB);
+  PHINode* PN = ast->ir_builder->CreatePHI(Type::getDoubleTy(*ast->TheContext), 2, "iftmp");
 
   PN->addIncoming(ThenV, ThenBB);
   PN->addIncoming(ElseV, ElseBB);
@@ -336,7 +833,7 @@ Value* ast_t::IfExprAST::codegen(ast_t* ast) {
 //   br endcond, loop, endloop
 // outloop:
 Value* ast_t::ForExprAST::codegen(ast_t* ast) {
-  Function* TheFunction = ir_builder->GetInsertBlock()->getParent();
+  Function* TheFunction = ast->ir_builder->GetInsertBlock()->getParent();
   // Create an alloca for the variable in the entry block.
   AllocaInst* Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
   ast->debug_info.emit_location(this);
@@ -347,34 +844,36 @@ Value* ast_t::ForExprAST::codegen(ast_t* ast) {
     return nullptr;
 
   // Store the value into the alloca.
-  ir_builder->CreateStore(StartVal, Alloca);
+  ast->ir_builder->CreateStore(StartVal, Alloca);
 
   // Within the loop, the variable is defined equal to the PHI node.
   // If it shadows an existing variable, we have to restore it, so save it now.
-  AllocaInst* OldVal = NamedValues[VarName];
-  NamedValues[VarName] = Alloca;
+  AllocaInst* OldVal = ast->NamedValues[VarName];
+  ast->NamedValues[VarName] = Alloca;
 
   // Create basic blocks for the loop
-  BasicBlock* CondBB = BasicBlock::Create(*TheContext, "loopcond", TheFunction);
-  BasicBlock* LoopBB = BasicBlock::Create(*TheContext, "loop", TheFunction);
-  BasicBlock* AfterBB = BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+  BasicBlock* CondBB = BasicBlock::Create(*ast->TheContext, "loopcond", TheFunction);
+  BasicBlock* LoopBB = BasicBlock::Create(*ast->TheContext, "loop", TheFunction);
+  BasicBlock* AfterBB = BasicBlock::Create(*ast->TheContext, "afterloop", TheFunction);
 
   // Fall through to condition check
-  ir_builder->CreateBr(CondBB);
+  ast->ir_builder->CreateBr(CondBB);
 
   // Emit condition check
-  ir_builder->SetInsertPoint(CondBB);
+  ast->ir_builder->SetInsertPoint(CondBB);
   // Compute the end condition.
   Value* EndCond = End->codegen(ast);
   if (!EndCond)
     return nullptr;
 
   // Convert condition to a bool by comparing non-equal to 0.0.
-  EndCond = ir_builder->CreateFCmpONE(EndCond, ConstantFP::get(*TheContext, APFloat(0.0)), "loopcond");
-  ir_builder->CreateCondBr(EndCond, LoopBB, AfterBB);
+  EndCond = ast->ir_builder->CreateFCmpONE(EndCond, ConstantFP::get(*ast->TheContext, APFloat(0.0)), "loopcond");
+  uint32_t ProfSlot = pgo_reserve(ast, 2);
+  pgo_weigh(ast, ast->ir_builder->CreateCondBr(EndCond, LoopBB, AfterBB), ProfSlot, nullptr);
 
   // Emit loop body
-  ir_builder->SetInsertPoint(LoopBB);
+  ast->ir_builder->SetInsertPoint(LoopBB);
+  emit_pgo_increment(ast, ProfSlot);
 
   // Generate code for the loop body
   if (auto* C = llvm::dyn_cast<CompoundExprAST>(Body.get())) {
@@ -397,34 +896,40 @@ Value* ast_t::ForExprAST::codegen(ast_t* ast) {
   }
   else {
     // If not specified, use 1.0.
-    StepVal = ConstantFP::get(*TheContext, APFloat(1.0));
+    StepVal = ConstantFP::get(*ast->TheContext, APFloat(1.0));
   }
 
   // Reload, increment, and restore the alloca.
-  Value* CurVar = ir_builder->CreateLoad(Type::getDoubleTy(*TheContext), Alloca, VarName.c_str());
-  Value* NextVar = ir_builder->CreateFAdd(CurVar, StepVal, "nextvar");
-  ir_builder->CreateStore(NextVar, Alloca);
+  Value* CurVar = ast->ir_builder->CreateLoad(Type::getDoubleTy(*ast->TheContext), Alloca, VarName.c_str());
+  Value* NextVar = ast->ir_builder->CreateFAdd(CurVar, StepVal, "nextvar");
+  ast->ir_builder->CreateStore(NextVar, Alloca);
 
-  // Branch back to condition check
-  ir_builder->CreateBr(CondBB);
+  // Back-edge counter for tiered compilation.
+  emit_tier_counter(ast);
+
+  // Branch back to condition check, the latch carries the loop hints.
+  BranchInst* BackEdge = ast->ir_builder->CreateBr(CondBB);
+  if (MDNode* LoopID = loop_metadata(ast, this))
+    BackEdge->setMetadata(LLVMContext::MD_loop, LoopID);
 
   // Insert the "after loop" block
-  ir_builder->SetInsertPoint(AfterBB);
+  ast->ir_builder->SetInsertPoint(AfterBB);
+  emit_pgo_increment(ast, ProfSlot + 1);
 
   // Restore the unshadowed variable.
   if (OldVal)
-    NamedValues[VarName] = OldVal;
+    ast->NamedValues[VarName] = OldVal;
   else
-    NamedValues.erase(VarName);
+    ast->NamedValues.erase(VarName);
 
   // for expr always returns 0.0.
-  return Constant::getNullValue(Type::getDoubleTy(*TheContext));
+  return Constant::getNullValue(Type::getDoubleTy(*ast->TheContext));
 }
 
 Value* ast_t::VarExprAST::codegen(ast_t* ast) {
   std::vector<AllocaInst*> OldBindings;
 
-  Function* TheFunction = ir_builder->GetInsertBlock()->getParent();
+  Function* TheFunction = ast->ir_builder->GetInsertBlock()->getParent();
 
   // Register all variables and emit their initializer.
   for (unsigned i = 0, e = VarNames.size(); i != e; ++i) {
@@ -443,18 +948,18 @@ Value* ast_t::VarExprAST::codegen(ast_t* ast) {
         return nullptr;
     }
     else { // If not specified, use 0.0.
-      InitVal = ConstantFP::get(*TheContext, APFloat(0.0));
+      InitVal = ConstantFP::get(*ast->TheContext, APFloat(0.0));
     }
 
     AllocaInst* Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
-    ir_builder->CreateStore(InitVal, Alloca);
+    ast->ir_builder->CreateStore(InitVal, Alloca);
 
     // Remember the old variable binding so that we can restore the binding when
     // we unrecurse.
-    OldBindings.push_back(NamedValues[VarName]);
+    OldBindings.push_back(ast->NamedValues[VarName]);
 
     // Remember this binding.
-    NamedValues[VarName] = Alloca;
+    ast->NamedValues[VarName] = Alloca;
   }
 
   ast->debug_info.emit_location(this);
@@ -466,7 +971,7 @@ Value* ast_t::VarExprAST::codegen(ast_t* ast) {
 
   // Pop all our variables from scope.
   for (unsigned i = 0, e = VarNames.size(); i != e; ++i)
-    NamedValues[VarNames[i].first] = OldBindings[i];
+    ast->NamedValues[VarNames[i].first] = OldBindings[i];
 
   // Return the body computation.
   return BodyVal;
@@ -479,10 +984,15 @@ Function* ast_t::PrototypeAST::codegen(ast_t* ast) {
   // Iterate through Args and ArgTypes to dynamically determine argument types
   for (size_t i = 0; i < Args.size(); ++i) {
     if (ArgTypes[i] == "double") {
-      ArgTypesLLVM.push_back(Type::getDoubleTy(*TheContext));
+      ArgTypesLLVM.push_back(Type::getDoubleTy(*ast->TheContext));
     }
     else if (ArgTypes[i] == "string") {
-      ArgTypesLLVM.push_back(PointerType::getUnqual(Type::getInt8Ty(*TheContext)));
+      // const fpp_string_t*
+      ArgTypesLLVM.push_back(PointerType::getUnqual(*ast->TheContext));
+    }
+    else if (ArgTypes[i] == "asset") {
+      // fpp_asset_t*
+      ArgTypesLLVM.push_back(PointerType::getUnqual(*ast->TheContext));
     }
     else {
       ast->debug_info.LogError(this->loc, "Unknown argument type");
@@ -491,7 +1001,7 @@ Function* ast_t::PrototypeAST::codegen(ast_t* ast) {
   }
 
   // Create the function type
-  FunctionType* FT = FunctionType::get(Type::getDoubleTy(*TheContext), ArgTypesLLVM, false);
+  FunctionType* FT = FunctionType::get(Type::getDoubleTy(*ast->TheContext), ArgTypesLLVM, false);
 
   // Create the function
   Function* F = Function::Create(FT, Function::ExternalLinkage, Name, ast->TheModule.get());
@@ -502,19 +1012,78 @@ Function* ast_t::PrototypeAST::codegen(ast_t* ast) {
     Arg.setName(Args[Idx++]);
   }
 
+  // '@' hints, on an extern they tell LLVM what the host function does.
+  for (const auto& Attr : Attributes) {
+    if (Attr.name == "inline")
+      F->addFnAttr(Attribute::AlwaysInline);
+    else if (Attr.name == "noinline")
+      F->addFnAttr(Attribute::NoInline);
+    else if (Attr.name == "hot")
+      F->addFnAttr(Attribute::Hot);
+    else if (Attr.name == "cold")
+      F->addFnAttr(Attribute::Cold);
+    else if (Attr.name == "pure") {
+      // memory(none), calls can be merged, hoisted and removed
+      F->setDoesNotAccessMemory();
+      F->setDoesNotThrow();
+      F->setWillReturn();
+    }
+    else if (Attr.name == "nounwind")
+      F->setDoesNotThrow();
+  }
+
   return F;
 }
 
 Function* ast_t::FunctionAST::codegen(ast_t* ast) {
+  // The prototype stays with the AST, the interpreter and later passes read it.
   auto& P = *Proto;
-  ast->FunctionProtos[Proto->getName()] = std::move(Proto);
+
+  // '@memo(N)' caches up to N results, N is rounded up to a power of two
+  const attribute_t* Memo = P.getAttribute("memo");
+  uint32_t MemoCapacity = 0;
+  if (Memo) {
+    for (const auto& ArgType : P.getArgTypes()) {
+      if (ArgType != "double") {
+        ast->debug_info.LogError(Memo->loc, "'@memo' needs double arguments in " + P.getName());
+        return nullptr;
+      }
+    }
+    double Size = Memo->has_value ? Memo->value : ast->memo.default_capacity;
+    if (!(Size >= 1 && Size <= (1 << 24))) {
+      ast->debug_info.LogError(Memo->loc, "'@memo' size must be between 1 and 16777216");
+      return nullptr;
+    }
+    MemoCapacity = PowerOf2Ceil(uint64_t(Size));
+  }
+
+  ast->FunctionProtos[Proto->getName()] = std::make_unique<PrototypeAST>(P);
   Function* TheFunction = getFunction(ast, P.getName());
   if (!TheFunction)
     return nullptr;
 
+  // A memoized body goes to <name>.impl and the function itself becomes the
+  // table lookup, so every call, recursive ones included, is cached.
+  Function* MemoWrapper = nullptr;
+  if (Memo) {
+    MemoWrapper = TheFunction;
+    TheFunction = Function::Create(MemoWrapper->getFunctionType(), Function::ExternalLinkage,
+      P.getName() + ".impl", ast->TheModule.get());
+    TheFunction->copyAttributesFrom(MemoWrapper);
+    for (auto [Arg, WrapperArg] : zip(TheFunction->args(), MemoWrapper->args()))
+      Arg.setName(WrapperArg.getName());
+  }
+
   // Create a single entry block
-  BasicBlock* BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
-  ir_builder->SetInsertPoint(BB);
+  BasicBlock* BB = BasicBlock::Create(*ast->TheContext, "entry", TheFunction);
+  ast->ir_builder->SetInsertPoint(BB);
+
+  // Opt-in fast-math allows reassociation and reciprocal approximations for
+  // every floating point instruction emitted in this function.
+  FastMathFlags FMF;
+  if (P.isFastMath())
+    FMF.setFast();
+  ast->ir_builder->setFastMathFlags(FMF);
 
   // Debug info setup
   DIFile* Unit = ast->DBuilder->createFile(ast->debug_info.di_compile_unit->getFilename(),
@@ -528,23 +1097,75 @@ Function* ast_t::FunctionAST::codegen(ast_t* ast) {
   ast->debug_info.lexical_blocks.push_back(SP);
   ast->debug_info.emit_location(nullptr);
 
-  // Record the function arguments in the NamedValues map
-  NamedValues.clear();
+  // Record the function arguments in the ast->NamedValues map
+  ast->NamedValues.clear();
+  std::vector<AllocaInst*> ArgAllocas;
   unsigned ArgIdx = 0;
   for (auto& Arg : TheFunction->args()) {
     AllocaInst* Alloca = CreateEntryBlockAlloca(TheFunction, Arg.getName());
     DILocalVariable* D = ast->DBuilder->createParameterVariable(SP, Arg.getName(), ++ArgIdx, Unit, LineNo, ast->debug_info.getDoubleTy(), true);
-    ast->DBuilder->insertDeclare(Alloca, D, ast->DBuilder->createExpression(), DILocation::get(SP->getContext(), LineNo, 0, SP), ir_builder->GetInsertBlock());
-    ir_builder->CreateStore(&Arg, Alloca);
-    NamedValues[std::string(Arg.getName())] = Alloca;
+    ast->DBuilder->insertDeclare(Alloca, D, ast->DBuilder->createExpression(), DILocation::get(SP->getContext(), LineNo, 0, SP), ast->ir_builder->GetInsertBlock());
+    ast->ir_builder->CreateStore(&Arg, Alloca);
+    ast->NamedValues[std::string(Arg.getName())] = Alloca;
+    ArgAllocas.push_back(Alloca);
+  }
+
+  // Counter 0 of every function is its entry count, the profile's entry is
+  // applied once the body showed how many counters it has.
+  ast->pgo.function = P.getName();
+  ast->pgo.next_counter = 0;
+  ast->pgo.weighted.clear();
+  emit_pgo_increment(ast, pgo_reserve(ast, 1));
+
+  // memoized functions are table lookups, every other function, main
+  // included, gets a slot and a counter
+  GlobalVariable* TierSlot = nullptr;
+  GlobalVariable* TierCounter = nullptr;
+  ast->tier.current = -1;
+  if (ast->tier.active && !Memo) {
+    Type* PtrTy = PointerType::getUnqual(*ast->TheContext);
+    Type* I64Ty = Type::getInt64Ty(*ast->TheContext);
+    TierSlot = new GlobalVariable(*ast->TheModule, PtrTy, false, GlobalValue::ExternalLinkage,
+      ConstantPointerNull::get(PointerType::getUnqual(*ast->TheContext)), P.getName() + ".slot");
+    TierCounter = new GlobalVariable(*ast->TheModule, I64Ty, false, GlobalValue::ExternalLinkage,
+      ConstantInt::get(I64Ty, 0), P.getName() + ".count");
+    ast->tier.current = ast->tier.functions.size();
+    ast->tier.index[P.getName()] = ast->tier.current;
+    ast->tier.functions.push_back(P.getName());
+    emit_tier_counter(ast);
+  }
+
+  // Self calls in tail position loop back to a header after the entry
+  // counters, deep recursion then runs in constant stack space.
+  ast->tail.reset();
+  ast->tail.zero_result = isa<CompoundExprAST>(Body.get());
+  mark_tail_calls(ast, Body.get(), P, true);
+  // a loop would skip the table
+  if (Memo)
+    ast->tail.self.clear();
+  if (!ast->tail.self.empty()) {
+    ast->tail.args = std::move(ArgAllocas);
+    ast->tail.header = BasicBlock::Create(*ast->TheContext, "tailrecurse", TheFunction);
+    ast->ir_builder->CreateBr(ast->tail.header);
+    ast->ir_builder->SetInsertPoint(ast->tail.header);
   }
 
   ast->debug_info.emit_location(Body.get());
 
   // Generate code for the body
   Value* RetVal = Body->codegen(ast);
+  ast->tail.reset();
   if (!RetVal) {
     TheFunction->eraseFromParent();
+    if (MemoWrapper)
+      MemoWrapper->eraseFromParent();
+    if (TierSlot) {
+      TierSlot->eraseFromParent();
+      TierCounter->eraseFromParent();
+      ast->tier.index.erase(P.getName());
+      ast->tier.functions.pop_back();
+    }
+    ast->tier.current = -1;
     if (P.isBinaryOp())
       ast->BinopPrecedence.erase(Proto->getOperatorName());
     ast->debug_info.lexical_blocks.pop_back();
@@ -552,11 +1173,23 @@ Function* ast_t::FunctionAST::codegen(ast_t* ast) {
   }
 
   // Create return instruction
-  ir_builder->CreateRet(RetVal);
+  ast->ir_builder->CreateRet(RetVal);
+  pgo_apply_entry(ast, TheFunction, P);
+
+  if (TierSlot)
+    TierSlot->setInitializer(TheFunction);
+  ast->tier.current = -1;
 
   ast->debug_info.lexical_blocks.pop_back();
 
   verifyFunction(*TheFunction);
 
+  if (MemoWrapper) {
+    emit_memo_wrapper(ast, MemoWrapper, TheFunction, MemoCapacity);
+    ast->memo.tables.push_back({ P.getName(), uint32_t(P.getArgs().size()), MemoCapacity });
+    verifyFunction(*MemoWrapper);
+    return MemoWrapper;
+  }
+
   return TheFunction;
 }
\ No newline at end of file
@@ -7,14 +7,21 @@
 #include "ast.h"
 
 namespace llvm {
-  namespace orc {
-    class KaleidoscopeJIT;
-  }
+  class DataLayout;
+  class Module;
+  class TargetMachine;
 }
 
-void codegen_init();
+/// init_targets - registers every LLVM target, safe to call from any thread.
+void init_targets();
 
-void create_the_JIT();
-std::unique_ptr<llvm::orc::KaleidoscopeJIT>& get_JIT();
+/// host_data_layout - data layout modules are compiled with.
+llvm::DataLayout host_data_layout();
 
-void init_module();
\ No newline at end of file
+/// init_module - fresh context and builder for ast, the module is created by
+/// the caller.
+void init_module(ast_t* ast);
+
+/// optimize_module - runs the default new pass manager pipeline for
+/// opt_level (0-3), target_machine is optional and enables target aware passes.
+void optimize_module(llvm::Module& module, int opt_level, llvm::TargetMachine* target_machine = nullptr);
\ No newline at end of file
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "fpp_string.h"
+#include "asset_table.h"
+
+//===----------------------------------------------------------------------===//
+// Render commands
+//
+// Library calls do not capture closures, each one writes a fixed size tagged
+// record into the task ring, which the render loop decodes with a switch in
+// fpp_run_tasks. Records are plain data: no allocation to queue one, no
+// destructor to run, and the ring's cells are reused every frame.
+//===----------------------------------------------------------------------===//
+
+// payload of the bulk commands, see bulk_pool_t in library.h
+struct bulk_block_t;
+
+enum class command_e : uint32_t {
+  print_number,
+  print_console,
+  print_stdout,
+  rectangle,
+  sprite,
+  set_position,
+  model,
+  clear,
+  rectangles,
+  sprites,
+  set_positions,
+  remove
+};
+
+struct command_t {
+  command_e type = command_e::clear;
+
+  struct print_number_t {
+    double value;
+  };
+  struct print_t {
+    const fpp_string_t* text;
+  };
+  struct rectangle_t {
+    uint64_t handle;
+    double px, py, sx, sy;
+    double angle;
+    uint32_t color;
+    // picked by the render thread
+    bool random_color;
+  };
+  struct sprite_t {
+    uint64_t handle;
+    // id in asset_table()
+    uint32_t asset;
+    double px, py, sx, sy;
+    double angle[3];
+  };
+  struct set_position_t {
+    uint64_t handle;
+    double px, py;
+  };
+  struct remove_t {
+    uint64_t handle;
+  };
+  struct model_t {
+    uint32_t asset;
+    double px, py, pz, scale;
+  };
+
+  // records of stride doubles, laid out as described by the bulk functions
+  // in library.h
+  struct bulk_t {
+    // holds the records, returned to the pool once applied
+    bulk_block_t* block;
+    uint64_t count;
+    // handle of the first shape created, the others follow it
+    uint64_t first;
+    // image of sprites
+    uint32_t asset;
+  };
+
+  union {
+    print_number_t print_number;
+    print_t print;
+    rectangle_t rectangle;
+    sprite_t sprite;
+    set_position_t set_position;
+    model_t model;
+    bulk_t bulk;
+    remove_t remove;
+  };
+
+  command_t() : print_number{} {}
+};
+
+static_assert(std::is_trivially_copyable_v<command_t>, "commands are copied as raw memory");
@@ -0,0 +1,190 @@
+#include "coroutine.h"
+
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+struct coroutine_t {
+  std::function<void()> entry;
+  scheduler_t* scheduler = nullptr;
+  bool done = false;
+#ifdef _WIN32
+  void* fiber = nullptr;
+  // the host's fiber belongs to the thread
+  bool owns_fiber = true;
+#else
+  ucontext_t context;
+  // guard page included
+  void* mapping = nullptr;
+  std::size_t mapping_size = 0;
+#endif
+
+  ~coroutine_t() {
+#ifdef _WIN32
+    if (fiber && owns_fiber) {
+      DeleteFiber(fiber);
+    }
+#else
+    if (mapping) {
+      munmap(mapping, mapping_size);
+    }
+#endif
+  }
+
+  // first code on the coroutine's stack, never returns
+  static void body(coroutine_t* self) {
+    self->entry();
+    self->done = true;
+    self->scheduler->suspend();
+  }
+};
+
+static thread_local scheduler_t* current_scheduler = nullptr;
+
+#ifdef _WIN32
+static void CALLBACK fiber_main(void* parameter) {
+  coroutine_t::body(static_cast<coroutine_t*>(parameter));
+}
+#else
+// makecontext passes only ints, the coroutine is handed over here instead
+static thread_local coroutine_t* starting = nullptr;
+
+static void context_main() {
+  coroutine_t::body(starting);
+}
+#endif
+
+scheduler_t::scheduler_t() : host(std::make_unique<coroutine_t>()) {
+#ifdef _WIN32
+  host->owns_fiber = false;
+#endif
+}
+
+scheduler_t::~scheduler_t() {
+  clear();
+}
+
+void scheduler_t::spawn(std::function<void()> entry) {
+  auto coroutine = std::make_unique<coroutine_t>();
+  coroutine->entry = std::move(entry);
+  coroutine->scheduler = this;
+#ifdef _WIN32
+  // reserves stack_size, Windows commits on demand behind its guard page
+  coroutine->fiber = CreateFiberEx(64 * 1024, stack_size, 0, fiber_main, coroutine.get());
+  if (!coroutine->fiber) {
+    return;
+  }
+#else
+  // the lowest page stays inaccessible, so running off the stack faults
+  // instead of writing into whatever lies below
+  std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+  std::size_t size = stack_size + page;
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return;
+  }
+  coroutine->mapping = mapping;
+  coroutine->mapping_size = size;
+  if (mprotect(mapping, page, PROT_NONE) != 0) {
+    return;
+  }
+  getcontext(&coroutine->context);
+  coroutine->context.uc_stack.ss_sp = static_cast<char*>(mapping) + page;
+  coroutine->context.uc_stack.ss_size = stack_size;
+  coroutine->context.uc_link = nullptr;
+  makecontext(&coroutine->context, context_main, 0);
+#endif
+  schedule(coroutine.get(), clock_t::now());
+  coroutines.push_back(std::move(coroutine));
+}
+
+void scheduler_t::schedule(coroutine_t* coroutine, clock_t::time_point due) {
+  timers.push(timer_t{ due, next_order++, coroutine });
+}
+
+void scheduler_t::poll() {
+  // coroutines filing timers for now while they run wait for the next poll
+  auto now = clock_t::now();
+  std::vector<coroutine_t*> due;
+  while (!timers.empty() && timers.top().due <= now) {
+    due.push_back(timers.top().coroutine);
+    timers.pop();
+  }
+  for (coroutine_t* coroutine : due) {
+    resume(coroutine);
+  }
+}
+
+void scheduler_t::run() {
+  while (size()) {
+    poll();
+    if (!timers.empty()) {
+      std::this_thread::sleep_until(timers.top().due);
+    }
+  }
+}
+
+void scheduler_t::clear() {
+  timers = decltype(timers){};
+  coroutines.clear();
+}
+
+std::size_t scheduler_t::size() const {
+  return coroutines.size();
+}
+
+scheduler_t* scheduler_t::current() {
+  return current_scheduler;
+}
+
+bool scheduler_t::sleep(double seconds) {
+  scheduler_t* scheduler = current_scheduler;
+  if (!scheduler || !scheduler->running) {
+    return false;
+  }
+  auto delay = std::chrono::duration_cast<clock_t::duration>(std::chrono::duration<double>(std::max(seconds, 0.0)));
+  scheduler->schedule(scheduler->running, clock_t::now() + delay);
+  scheduler->suspend();
+  return true;
+}
+
+void scheduler_t::resume(coroutine_t* coroutine) {
+  scheduler_t* previous = current_scheduler;
+  current_scheduler = this;
+  running = coroutine;
+#ifdef _WIN32
+  if (!IsThreadAFiber()) {
+    ConvertThreadToFiber(nullptr);
+  }
+  host->fiber = GetCurrentFiber();
+  SwitchToFiber(coroutine->fiber);
+#else
+  starting = coroutine;
+  swapcontext(&host->context, &coroutine->context);
+#endif
+  running = nullptr;
+  current_scheduler = previous;
+
+  if (coroutine->done) {
+    auto found = std::find_if(coroutines.begin(), coroutines.end(), [coroutine](const auto& owned) {
+      return owned.get() == coroutine;
+    });
+    std::swap(*found, coroutines.back());
+    coroutines.pop_back();
+  }
+}
+
+void scheduler_t::suspend() {
+#ifdef _WIN32
+  SwitchToFiber(host->fiber);
+#else
+  swapcontext(&running->context, &host->context);
+#endif
+}
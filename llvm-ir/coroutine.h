@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+//===----------------------------------------------------------------------===//
+// Script coroutines
+//
+// Scripts run as stackful coroutines (fibers on Windows, ucontext elsewhere)
+// on a scheduler_t. sleep_s suspends the running coroutine and files a timer
+// in a heap ordered by wake time, poll resumes every coroutine whose timer
+// fired. A sleeping script costs the stack pages it touched and one heap
+// entry, so thousands of them share the thread that polls. Dropping a
+// suspended coroutine frees its stack without unwinding it, which is fine for
+// script frames: they hold no destructors.
+//===----------------------------------------------------------------------===//
+
+struct coroutine_t;
+
+struct scheduler_t {
+  using clock_t = std::chrono::steady_clock;
+
+  // address space reserved for the stack of every coroutine, as much as a
+  // thread gets. Pages are committed as they are touched, a guard page
+  // below it turns an overflow into a fault.
+  static constexpr std::size_t stack_size = 8 * 1024 * 1024;
+
+  scheduler_t();
+  ~scheduler_t();
+
+  /// spawn - starts entry as a coroutine on the next poll.
+  void spawn(std::function<void()> entry);
+
+  /// poll - resumes the coroutines that are due, each at most once.
+  void poll();
+
+  /// run - polls until every coroutine finished, sleeping until the next
+  /// timer in between.
+  void run();
+
+  /// clear - drops every coroutine, running or suspended. Not from inside one.
+  void clear();
+
+  /// size - coroutines that have not finished.
+  std::size_t size() const;
+
+  /// current - the scheduler running the calling coroutine, null outside.
+  static scheduler_t* current();
+
+  /// sleep - suspends the calling coroutine for seconds, false when it is
+  /// not called from a coroutine.
+  static bool sleep(double seconds);
+
+  // looks up a def without arguments for the spawn extern, null if unknown
+  std::function<void*(const std::string& name)> resolve;
+
+private:
+  struct timer_t {
+    clock_t::time_point due;
+    // first filed runs first among equal times
+    uint64_t order;
+    coroutine_t* coroutine;
+
+    bool operator>(const timer_t& other) const {
+      return due != other.due ? due > other.due : order > other.order;
+    }
+  };
+
+  void schedule(coroutine_t* coroutine, clock_t::time_point due);
+  void resume(coroutine_t* coroutine);
+  void suspend();
+
+  std::priority_queue<timer_t, std::vector<timer_t>, std::greater<timer_t>> timers;
+  std::vector<std::unique_ptr<coroutine_t>> coroutines;
+  uint64_t next_order = 0;
+  coroutine_t* running = nullptr;
+  // the context poll resumes coroutines from
+  std::unique_ptr<coroutine_t> host;
+
+  friend struct coroutine_t;
+};
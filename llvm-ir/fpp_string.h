@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+//===----------------------------------------------------------------------===//
+// Script strings
+//
+// Every distinct string literal of a module compiles to one constant
+// fpp_string_t, and a 'string' argument is a pointer to it. The compiler
+// hashes the literal with the same fpp_hash the runtime uses, so runtime code
+// compares and looks strings up without rescanning them, and keeps the
+// pointer instead of copying the characters. Literals live as long as the
+// engine that loaded them.
+//===----------------------------------------------------------------------===//
+
+struct fpp_string_t {
+  // zero terminated
+  const char* data;
+  uint64_t size;
+  uint64_t hash;
+};
+
+/// fpp_hash - 64-bit FNV-1a of data.
+constexpr uint64_t fpp_hash(const char* data, uint64_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (uint64_t i = 0; i < size; ++i) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/// fpp_make_string - wraps data, which has to stay alive and zero terminated.
+inline fpp_string_t fpp_make_string(const char* data, uint64_t size) {
+  return fpp_string_t{ data, size, fpp_hash(data, size) };
+}
+
+inline std::string_view fpp_view(const fpp_string_t& string) {
+  return std::string_view(string.data, string.size);
+}
+
+/// fpp_equal - the hash rejects almost every mismatch before the characters
+/// are compared.
+inline bool fpp_equal(const fpp_string_t& a, const fpp_string_t& b) {
+  return a.hash == b.hash && a.size == b.size &&
+    (a.data == b.data || std::memcmp(a.data, b.data, a.size) == 0);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//===----------------------------------------------------------------------===//
+// Handle table
+//
+// Hands out shape handles on the script thread, so creating a shape returns
+// its handle right away while the shape itself is made later by the render
+// thread. A handle is generation << 32 | slot. Removing a shape bumps the
+// slot's generation before the slot is reused, so a stale handle never
+// reaches the new shape. Handles stay below 2^53 and survive the round trip
+// through a script double, 0 is never a valid handle.
+//===----------------------------------------------------------------------===//
+
+struct handle_table_t {
+  static constexpr uint32_t generation_limit = 1u << 21;
+
+  static constexpr uint32_t slot_of(uint64_t handle) {
+    return (uint32_t)handle;
+  }
+  static constexpr uint32_t generation_of(uint64_t handle) {
+    return (uint32_t)(handle >> 32);
+  }
+  static constexpr uint64_t make(uint32_t slot, uint32_t generation) {
+    return (uint64_t)generation << 32 | slot;
+  }
+
+  /// reserve - a handle for a new shape, reusing a free slot if there is one.
+  uint64_t reserve() {
+    if (free.empty()) {
+      return reserve_fresh(1);
+    }
+    uint32_t slot = free.back();
+    free.pop_back();
+    alive[slot] = true;
+    return make(slot, generations[slot]);
+  }
+
+  /// reserve_fresh - count handles in never used slots, which all share the
+  /// first generation, so they are first, first + 1, ... first + count - 1.
+  uint64_t reserve_fresh(uint32_t count) {
+    auto slot = (uint32_t)generations.size();
+    generations.resize(generations.size() + count, 1);
+    alive.resize(alive.size() + count, true);
+    return make(slot, 1);
+  }
+
+  /// fresh_left - the most handles reserve_fresh can still return, slots
+  /// are 32 bits.
+  uint64_t fresh_left() const {
+    return UINT32_MAX - generations.size();
+  }
+
+  /// valid - handle names a live shape.
+  bool valid(uint64_t handle) const {
+    uint32_t slot = slot_of(handle);
+    return slot < generations.size() && alive[slot] && generations[slot] == generation_of(handle);
+  }
+
+  /// release - frees the slot of handle, false if it was not valid.
+  bool release(uint64_t handle) {
+    if (!valid(handle)) {
+      return false;
+    }
+    retire(slot_of(handle));
+    return true;
+  }
+
+  /// release_all - invalidates every handle.
+  void release_all() {
+    for (uint32_t slot = 0; slot < alive.size(); ++slot) {
+      if (alive[slot]) {
+        retire(slot);
+      }
+    }
+  }
+
+private:
+  void retire(uint32_t slot) {
+    alive[slot] = false;
+    // a slot whose generations ran out is never reused
+    if (++generations[slot] < generation_limit) {
+      free.push_back(slot);
+    }
+  }
+
+  std::vector<uint32_t> generations;
+  std::vector<bool> alive;
+  std::vector<uint32_t> free;
+};
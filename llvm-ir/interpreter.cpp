@@ -0,0 +1,285 @@
+#include "interpreter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
+#include "math_library.h"
+
+using ExprAST = ast_t::ExprAST;
+
+void interpreter_t::bind(std::vector<std::unique_ptr<ast_t::FunctionAST>>& parsed) {
+  functions.clear();
+  for (auto& function : parsed) {
+    functions[function->getName()].ast = function.get();
+  }
+  strings.clear();
+  scope.clear();
+  frame_base = 0;
+  failed = false;
+  error.clear();
+}
+
+void interpreter_t::attach_native(llvm::ExecutionEngine* engine) {
+  for (auto& [name, function] : functions) {
+    const auto& types = function.ast->getProto().getArgTypes();
+    bool doubles_only = std::all_of(types.begin(), types.end(), [](const std::string& type) {
+      return type == "double";
+    });
+    if (doubles_only) {
+      if (uint64_t address = engine->getFunctionAddress(name)) {
+        function.native.store(reinterpret_cast<void*>(address), std::memory_order_release);
+      }
+    }
+  }
+}
+
+bool interpreter_t::call(const std::string& name, const std::vector<value_t>& args, value_t& result) {
+  failed = false;
+  error.clear();
+  steps = 0;
+  depth = 0;
+  char marker;
+  stack_base = reinterpret_cast<uintptr_t>(&marker);
+  auto found = functions.find(name);
+  if (found == functions.end()) {
+    error = "'" + name + "' function not found";
+    return false;
+  }
+  result = call_function(found->second, args);
+  return !failed;
+}
+
+interpreter_t::value_t interpreter_t::fail(const source_location_t& loc, const std::string& message) {
+  if (!failed) {
+    error = "Error: " + message + ", at " + std::to_string(loc.line) + ":" + std::to_string(loc.col) + "\n";
+    failed = true;
+  }
+  return {};
+}
+
+interpreter_t::value_t* interpreter_t::lookup(const std::string& name) {
+  for (std::size_t i = scope.size(); i-- > frame_base;) {
+    if (scope[i].first == name) {
+      return &scope[i].second;
+    }
+  }
+  return nullptr;
+}
+
+/// call_native - calls a JIT compiled function taking N doubles.
+template <std::size_t... I>
+static double call_native(void* address, const std::vector<interpreter_t::value_t>& args, std::index_sequence<I...>) {
+  using fn_t = double(*)(decltype((void)I, 0.0)...);
+  return reinterpret_cast<fn_t>(address)(args[I].number...);
+}
+
+interpreter_t::value_t interpreter_t::call_function(function_t& function, const std::vector<value_t>& args) {
+  const auto& proto = function.ast->getProto();
+  if (proto.getArgs().size() != args.size()) {
+    return fail({ proto.getLine(), 0 }, "Incorrect # arguments passed to " + proto.getName());
+  }
+
+  if (void* native = function.native.load(std::memory_order_acquire)) {
+    switch (args.size()) {
+    case 0: return { call_native(native, args, std::make_index_sequence<0>{}) };
+    case 1: return { call_native(native, args, std::make_index_sequence<1>{}) };
+    case 2: return { call_native(native, args, std::make_index_sequence<2>{}) };
+    case 3: return { call_native(native, args, std::make_index_sequence<3>{}) };
+    case 4: return { call_native(native, args, std::make_index_sequence<4>{}) };
+    case 5: return { call_native(native, args, std::make_index_sequence<5>{}) };
+    case 6: return { call_native(native, args, std::make_index_sequence<6>{}) };
+    case 7: return { call_native(native, args, std::make_index_sequence<7>{}) };
+    case 8: return { call_native(native, args, std::make_index_sequence<8>{}) };
+    default: break;
+    }
+  }
+
+  if (depth_limit && depth >= depth_limit) {
+    return fail({ proto.getLine(), 0 }, "call depth limit exceeded in " + proto.getName());
+  }
+  if (stack_limit) {
+    char marker;
+    uintptr_t here = reinterpret_cast<uintptr_t>(&marker);
+    if ((here < stack_base ? stack_base - here : here - stack_base) > stack_limit) {
+      return fail({ proto.getLine(), 0 }, "stack limit exceeded in " + proto.getName());
+    }
+  }
+
+  std::size_t old_base = frame_base;
+  std::size_t old_size = scope.size();
+  frame_base = old_size;
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    scope.emplace_back(proto.getArgs()[i], args[i]);
+  }
+
+  ++depth;
+  value_t result = eval(function.ast->getBody().get());
+  --depth;
+
+  scope.resize(old_size);
+  frame_base = old_base;
+  return result;
+}
+
+/// truth - if/for conditions use an ordered compare against 0.0, NaN is false.
+static bool truth(double value) {
+  return value < 0.0 || value > 0.0;
+}
+
+interpreter_t::value_t interpreter_t::eval(ExprAST* expr) {
+  if (failed) {
+    return {};
+  }
+  if (step_budget && ++steps > step_budget) {
+    return fail(expr->loc, "step budget exceeded");
+  }
+
+  switch (expr->getKind()) {
+  case ExprAST::Expr_Number: {
+    return { static_cast<ast_t::NumberExprAST*>(expr)->getVal() };
+  }
+  case ExprAST::Expr_String: {
+    const std::string& literal = static_cast<ast_t::StringExprAST*>(expr)->getVal();
+    auto found = strings.find(literal);
+    if (found == strings.end()) {
+      found = strings.emplace(literal, fpp_string_t{}).first;
+      found->second = fpp_make_string(found->first.c_str(), found->first.size());
+    }
+    return { 0, &found->second };
+  }
+  case ExprAST::Expr_Variable: {
+    auto* variable = static_cast<ast_t::VariableExprAST*>(expr);
+    if (value_t* value = lookup(variable->getName())) {
+      return *value;
+    }
+    return fail(expr->loc, "Unknown variable name");
+  }
+  case ExprAST::Expr_Unary: {
+    auto* unary = static_cast<ast_t::UnaryExprAST*>(expr);
+    double operand = eval(unary->getOperand().get()).number;
+    switch (unary->getOpcode()) {
+    case '!': return { operand == 0.0 ? 1.0 : 0.0 };
+    case '&': return { (double)((int64_t)operand & 1) };
+    case '-': return { -operand };
+    default: break;
+    }
+    auto found = functions.find(std::string("unary") + unary->getOpcode());
+    if (found == functions.end()) {
+      return fail(expr->loc, "Unknown unary operator");
+    }
+    return call_function(found->second, { value_t{ operand } });
+  }
+  case ExprAST::Expr_Binary: {
+    auto* binary = static_cast<ast_t::BinaryExprAST*>(expr);
+    if (binary->getOp() == '=') {
+      auto* destination = llvm::dyn_cast<ast_t::VariableExprAST>(binary->getLHS().get());
+      if (!destination) {
+        return fail(expr->loc, "destination of '=' must be a variable");
+      }
+      value_t value = eval(binary->getRHS().get());
+      value_t* variable = lookup(destination->getName());
+      if (!variable) {
+        return fail(expr->loc, "Unknown variable name");
+      }
+      *variable = value;
+      return value;
+    }
+    double l = eval(binary->getLHS().get()).number;
+    double r = eval(binary->getRHS().get()).number;
+    switch (binary->getOp()) {
+    case '+': return { l + r };
+    case '-': return { l - r };
+    case '*': return { l * r };
+    case '/': return { l / r };
+    // unordered compares, true when either side is NaN
+    case '<': return { !(l >= r) ? 1.0 : 0.0 };
+    case '>': return { !(l <= r) ? 1.0 : 0.0 };
+    case '%': return { l - std::floor(l / r) * r };
+    case '|': return { (l != 0.0 || r != 0.0) ? 1.0 : 0.0 };
+    case '&': return { (l != 0.0 && r != 0.0) ? 1.0 : 0.0 };
+    default: break;
+    }
+    auto found = functions.find(std::string("binary") + binary->getOp());
+    if (found == functions.end()) {
+      return fail(expr->loc, "binary operator not found");
+    }
+    return call_function(found->second, { value_t{ l }, value_t{ r } });
+  }
+  case ExprAST::Expr_Call: {
+    auto* call = static_cast<ast_t::CallExprAST*>(expr);
+    std::vector<value_t> args;
+    args.reserve(call->getArgs().size());
+    for (auto& arg : call->getArgs()) {
+      args.push_back(eval(arg.get()));
+    }
+    if (failed) {
+      return {};
+    }
+    const std::string& callee = call->getCallee();
+    auto function = functions.find(callee);
+    if (function != functions.end()) {
+      return call_function(function->second, args);
+    }
+    if (auto* builtin = find_math_builtin(callee)) {
+      if (builtin->arity != args.size()) {
+        return fail(expr->loc, "Incorrect # arguments passed to " + callee);
+      }
+      double numbers[3]{};
+      for (std::size_t i = 0; i < args.size(); ++i) {
+        numbers[i] = args[i].number;
+      }
+      return { builtin->eval(numbers) };
+    }
+    auto external = externs.find(callee);
+    if (external == externs.end()) {
+      return fail(expr->loc, "Unknown function referenced:" + callee);
+    }
+    if (external->second.arity != args.size()) {
+      return fail(expr->loc, "Incorrect # arguments passed");
+    }
+    return external->second.thunk(args.data());
+  }
+  case ExprAST::Expr_If: {
+    auto* if_expr = static_cast<ast_t::IfExprAST*>(expr);
+    if (truth(eval(if_expr->getCond().get()).number)) {
+      return eval(if_expr->getThen().get());
+    }
+    return eval(if_expr->getElse().get());
+  }
+  case ExprAST::Expr_For: {
+    auto* for_expr = static_cast<ast_t::ForExprAST*>(expr);
+    value_t start = eval(for_expr->getStart().get());
+    scope.emplace_back(for_expr->getVarName(), start);
+    std::size_t slot = scope.size() - 1;
+    while (!failed && truth(eval(for_expr->getEnd().get()).number)) {
+      eval(for_expr->getBody().get());
+      double step = for_expr->getStep() ? eval(for_expr->getStep().get()).number : 1.0;
+      scope[slot].second.number += step;
+    }
+    scope.pop_back();
+    return {};
+  }
+  case ExprAST::Expr_Var: {
+    auto* var = static_cast<ast_t::VarExprAST*>(expr);
+    std::size_t old_size = scope.size();
+    for (auto& [name, init] : var->getVarNames()) {
+      // the initializer does not see the variable it initializes
+      value_t value = init ? eval(init.get()) : value_t{};
+      scope.emplace_back(name, value);
+    }
+    value_t result = eval(var->getBody().get());
+    scope.resize(old_size);
+    return result;
+  }
+  case ExprAST::Expr_Compound: {
+    for (auto& statement : static_cast<ast_t::CompoundExprAST*>(expr)->getStatements()) {
+      eval(statement.get());
+    }
+    return {};
+  }
+  }
+  return fail(expr->loc, "unknown expression");
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "fpp_string.h"
+#include "asset_table.h"
+
+namespace llvm {
+  class ExecutionEngine;
+}
+
+//===----------------------------------------------------------------------===//
+// Interpreter tier
+//
+// Walks the parsed AST directly, no LLVM module, target or JIT is needed, so
+// a script starts executing as soon as it is parsed. Externs are dispatched
+// through typed thunks registered by the host (see library.h). Once a JIT
+// build is attached, calls to script functions switch to native code.
+//===----------------------------------------------------------------------===//
+
+struct interpreter_t {
+  struct value_t {
+    double number = 0;
+    const fpp_string_t* string = nullptr;
+  };
+
+  using thunk_t = value_t(*)(const value_t* args);
+
+  struct extern_t {
+    unsigned arity;
+    thunk_t thunk;
+  };
+
+  /// add_extern - makes the C function fn callable from scripts as name.
+  template <auto fn>
+  void add_extern(const std::string& name) {
+    externs[name] = extern_t{ arity(fn), [](const value_t* args) {
+      return invoke(fn, args, std::make_index_sequence<arity(fn)>{});
+    } };
+  }
+
+  /// bind - indexes the parsed functions, call before call().
+  void bind(std::vector<std::unique_ptr<ast_t::FunctionAST>>& functions);
+
+  /// attach_native - from now on script functions whose arguments are all
+  /// doubles run the JIT compiled code. Safe to call while interpreting.
+  void attach_native(llvm::ExecutionEngine* engine);
+
+  /// call - runs name with args, returns false and fills error on failure.
+  bool call(const std::string& name, const std::vector<value_t>& args, value_t& result);
+
+  std::map<std::string, extern_t> externs;
+  std::string error;
+
+  // limits for a single call(), 0 for none. Compile time evaluation uses
+  // them to give up on slow or non-terminating functions. stack_limit bounds
+  // the native stack the call uses, as a frame's size depends on the build.
+  uint64_t step_budget = 0;
+  uint32_t depth_limit = 0;
+  std::size_t stack_limit = 0;
+
+private:
+  template <typename R, typename... A>
+  static constexpr unsigned arity(R(*)(A...)) {
+    return sizeof...(A);
+  }
+
+  template <typename T>
+  static T unpack(const value_t& value) {
+    if constexpr (std::is_same_v<T, fpp_asset_t*>) {
+      // no module asset table here, the path is looked up on every call
+      return value.string ? asset_table().slot(*value.string) : nullptr;
+    }
+    else if constexpr (std::is_pointer_v<T>) {
+      return value.string;
+    }
+    else {
+      return (T)value.number;
+    }
+  }
+
+  template <typename R, typename... A, std::size_t... I>
+  static value_t invoke(R(*fn)(A...), const value_t* args, std::index_sequence<I...>) {
+    return value_t{ (double)fn(unpack<A>(args[I])...) };
+  }
+
+  struct function_t {
+    ast_t::FunctionAST* ast = nullptr;
+    // JIT compiled entry, published by attach_native
+    std::atomic<void*> native{ nullptr };
+  };
+
+  value_t eval(ast_t::ExprAST* expr);
+  value_t call_function(function_t& function, const std::vector<value_t>& args);
+  value_t fail(const source_location_t& loc, const std::string& message);
+  value_t* lookup(const std::string& name);
+
+  std::map<std::string, function_t> functions;
+  // literals by value, like the pool of a compiled module. The characters
+  // are the keys, which map nodes never move.
+  std::map<std::string, fpp_string_t, std::less<>> strings;
+
+  // variables visible to the current call start at frame_base
+  std::vector<std::pair<std::string, value_t>> scope;
+  std::size_t frame_base = 0;
+  bool failed = false;
+  uint64_t steps = 0;
+  uint32_t depth = 0;
+  // stack address where the current call() started
+  uintptr_t stack_base = 0;
+};
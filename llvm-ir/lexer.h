@@ -4,8 +4,6 @@
 #include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/IRBuilder.h>
 
-extern std::unique_ptr<llvm::IRBuilder<>> ir_builder;
-
 //===----------------------------------------------------------------------===//
 // Lexer
 //===----------------------------------------------------------------------===//
@@ -37,6 +35,13 @@ enum token_e {
   tok_literal_string,
   tok_type_string,
   tok_type_double,
+  tok_type_asset,
+
+  // '@' identifier, an optimization hint
+  tok_attribute,
+
+  // 'import' "file.fpp"
+  tok_import,
 };
 
 struct source_location_t {
@@ -124,9 +129,21 @@ struct lexer_t {
         return tok_type_string;
       if (identifier_string == "double")
         return tok_type_double;
+      if (identifier_string == "asset")
+        return tok_type_asset;
+      if (identifier_string == "import")
+        return tok_import;
       return tok_identifier;
     }
 
+    // Attribute: '@' [a-zA-Z0-9_]*
+    if (last_char == '@') {
+      identifier_string.clear();
+      while (isalnum(last_char = advance()) || last_char == '_')
+        identifier_string += last_char;
+      return tok_attribute;
+    }
+
     // Number: [0-9.]+
     if (isdigit(last_char) || last_char == '.') {
       std::string num_str;
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <array>
+#include <cmath>
+#include <map>
+
+#include "interpreter.h"
+
 //===----------------------------------------------------------------------===//
 // "Library" functions that can be "extern'd" from user code.
 //===----------------------------------------------------------------------===//
@@ -10,208 +16,926 @@
 #define DLLEXPORT
 #endif
 
-inline std::mutex g_mutex, task_queue_mutex;
+// every binary includes this file from one translation unit, which exports
+// the inlinable helpers too
+#define FPP_RUNTIME_INLINE_IMPLEMENTATION
+#include "runtime_inline.h"
+#include "task_ring.h"
+#include "command.h"
+#include "handle_table.h"
+#include "coroutine.h"
+#include "asset_cache.h"
+#include "backend.h"
+#include "recording_backend.h"
+
+inline std::mutex g_mutex;
 inline std::condition_variable g_cv;
 
-inline std::vector<fan::function_t<void()>> task_queue;
+// library calls made by scripts, run by the render loop in fpp_run_tasks
+inline task_ring_t<command_t, 1 << 16> task_queue;
+// thread that last ran fpp_run_tasks
+inline std::atomic<std::thread::id> task_consumer;
+inline std::atomic<bool> task_draining{ false };
+
 inline std::vector<fan::function_t<void()>> lib_queue;
 
-/// putchard - putchar that takes a double and returns 0.
-extern "C" DLLEXPORT double putchard(double x) {
-  fputc((char)x, stderr);
-  return 0;
+extern "C" DLLEXPORT void fpp_run_tasks();
+
+/// wait_for_task_space - called while the queue is full. Ahead-of-time
+/// scripts run on the render thread before its loop starts, so when no other
+/// thread consumes the queue the caller drains it itself.
+inline void wait_for_task_space() {
+  std::thread::id consumer = task_consumer.load(std::memory_order_relaxed);
+  if (consumer == std::thread::id() || consumer == std::this_thread::get_id()) {
+    fpp_run_tasks();
+  }
+  else {
+    std::this_thread::yield();
+  }
+}
+
+/// push_command - queues a library call for the render thread.
+inline void push_command(command_t command) {
+  while (!task_queue.try_push(std::move(command))) {
+    wait_for_task_space();
+  }
 }
 
+// handles of the shapes scripts created, owned by the thread running the
+// script: main's thread, then the render loop calling update
+inline handle_table_t shape_handles;
+
 #ifndef no_graphics
-inline std::vector<loco_t::shape_t> shapes;
-// cache images
-inline std::unordered_map<std::string, loco_t::image_t> images;
+/// loco_backend_t - draws through fan on the window of gloco.
+struct loco_backend_t : backend_t {
+  // the models of one file. fan takes the transform through
+  // properties_t::model when a model is built, so every distinct placement
+  // is its own model_t. They are kept across runs, placing the same
+  // transform again does not parse the file again.
+  struct model_entry_t {
+    std::string path;
+    // by px, py, pz, scale
+    std::map<std::array<double, 4>, std::unique_ptr<fan::graphics::model_t>> placed;
+    // the placements of this run, in model3d order
+    std::vector<fan::graphics::model_t*> instances;
+  };
+
+  // by handle slot
+  std::vector<std::optional<loco_t::shape_t>> shapes;
+  // by image id
+  std::vector<loco_t::image_t> images;
+  // by asset id
+  std::vector<model_entry_t> models;
+  bool hooked = false;
+
+  void print(std::string_view text, print_e target) override {
+    std::string line(text);
+    if (target == print_e::console) {
+      fan::printcl(line);
+    }
+    else {
+      fan::print(line);
+    }
+  }
 
-inline std::vector<fan::graphics::model_t> models;
+  uint32_t random_color() override {
+    return (uint32_t)fan::random::color().get_hex();
+  }
 
+  void add_rectangle(uint32_t slot, double px, double py, double depth, double sx, double sy, uint32_t color, double angle) override {
+    store(slot, fan::graphics::rectangle_t{ {
+        .position = fan::vec3(px, py, depth),
+        .size = fan::vec2(sx, sx),
+        .color = fan::color::hex(color),
+        .angle = angle
+    } });
+  }
+
+  void add_sprite(uint32_t slot, uint32_t image, double px, double py, double depth, double sx, double sy, const double (&angle)[3]) override {
+    store(slot, fan::graphics::sprite_t{ {
+        .position = fan::vec3(px, py, depth),
+        .size = fan::vec2(sx, sx),
+        .angle = fan::vec3(angle[0], angle[1], angle[2]),
+        .image = images[image]
+    } });
+  }
+
+  void move_shape(uint32_t slot, double px, double py) override {
+    shapes[slot]->set_position(fan::vec2(px, py));
+  }
+
+  void set_image(uint32_t slot, uint32_t image) override {
+    shapes[slot]->set_image(images[image]);
+  }
+
+  void remove_shape(uint32_t slot) override {
+    shapes[slot].reset();
+  }
+
+  void clear_shapes() override {
+    shapes.clear();
+  }
+
+  /// decode_image - the CPU half of gloco->image_load.
+  bool decode_image(const std::string& path, decoded_image_t& image) override {
+    fan::image::image_info_t info;
+    if (fan::image::load(path, &info)) {
+      return false;
+    }
+    image.width = info.size.x;
+    image.height = info.size.y;
+    image.channels = info.channels > 0 ? info.channels : 4;
+    auto* data = static_cast<const uint8_t*>(info.data);
+    image.pixels.assign(data, data + (std::size_t)image.width * image.height * image.channels);
+    fan::image::free(&info);
+    return true;
+  }
+
+  /// upload_image - the GPU half.
+  uint32_t upload_image(const decoded_image_t& image) override {
+    fan::image::image_info_t info;
+    info.data = (void*)image.pixels.data();
+    info.size = fan::vec2i(image.width, image.height);
+    info.channels = image.channels;
+    return add_image(gloco->image_load(info));
+  }
+
+  uint32_t load_image(const std::string& path) override {
+    return add_image(gloco->image_load(path));
+  }
+
+  void load_model(uint32_t asset, const std::string& path) override {
+    if (!hooked) {
+      gloco->m_pre_draw.push_back([this] {
+        draw_models();
+      });
+      hooked = true;
+    }
+    if (asset >= models.size()) {
+      models.resize(asset + 1);
+    }
+    models[asset].path = path;
+  }
+
+  void add_model_instance(uint32_t asset, double px, double py, double pz, double scale) override {
+    model_entry_t& entry = models[asset];
+    auto& model = entry.placed[{ px, py, pz, scale }];
+    if (!model) {
+      fan::graphics::model_t::properties_t mp;
+      mp.path = entry.path;
+      mp.model = mp.model.translate(fan::vec3(px, py, pz)).scale(scale);
+      model = std::make_unique<fan::graphics::model_t>(mp);
+    }
+    entry.instances.push_back(model.get());
+  }
+
+  void clear_models() override {
+    for (auto& entry : models) {
+      entry.instances.clear();
+    }
+  }
+
+  /// draw_models - the single pre-draw hook, draws every placed model.
+  void draw_models() {
+    for (auto& entry : models) {
+      for (fan::graphics::model_t* model : entry.instances) {
+        model->draw();
+      }
+    }
+  }
+
+private:
+  void store(uint32_t slot, loco_t::shape_t&& shape) {
+    if (slot >= shapes.size()) {
+      shapes.resize(slot + 1);
+    }
+    shapes[slot] = std::move(shape);
+  }
+
+  uint32_t add_image(loco_t::image_t image) {
+    images.push_back(image);
+    return (uint32_t)images.size() - 1;
+  }
+};
 #endif
 
-/// printd - printf that takes a double prints it as "%f\n", returning 0.
-extern "C" DLLEXPORT double printd(double x) {
+/// default_backend - loco in builds with graphics, the recording backend in
+/// -Dno_graphics builds.
+inline backend_t& default_backend() {
 #ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    fan::printcl((uint64_t)x);
-  });
+  static loco_backend_t backend;
+#else
+  static recording_backend_t backend;
 #endif
-  return 0;
+  return backend;
 }
-extern "C" DLLEXPORT double printcl(const char* x) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    fan::printcl(x);
+
+// set by set_backend, null for default_backend()
+inline std::atomic<backend_t*> active_backend{ nullptr };
+
+/// backend - where fpp_run_tasks applies the commands.
+inline backend_t& backend() {
+  backend_t* active = active_backend.load(std::memory_order_acquire);
+  return active ? *active : default_backend();
+}
+
+// render state, owned by the thread running fpp_run_tasks. A shape slot is
+// live while the backend holds the shape of the handle with its generation,
+// commands naming an older or removed handle are ignored.
+struct shape_slot_t {
+  uint32_t generation = 0;
+  bool live = false;
+};
+inline std::vector<shape_slot_t> shapes;
+// z of the next shape
+inline int depth = 0;
+// backend images by asset id, see asset_table.h
+inline std::vector<std::optional<uint32_t>> images;
+inline std::optional<uint32_t> placeholder;
+// sprites showing the placeholder until the image of an asset id is uploaded
+inline std::unordered_map<uint32_t, std::vector<uint64_t>> pending_images;
+// models the backend loaded, by asset id
+inline std::vector<bool> loaded_models;
+
+/// set_backend - applies the commands to next from now on, null goes back to
+/// default_backend(). Call it on the thread running fpp_run_tasks, or while
+/// none runs, with the queue empty. The render state starts over, shapes
+/// created before the switch are ignored.
+inline void set_backend(backend_t* next) {
+  shapes.clear();
+  depth = 0;
+  images.clear();
+  placeholder.reset();
+  pending_images.clear();
+  loaded_models.clear();
+  active_backend.store(next, std::memory_order_release);
+}
+
+/// asset_loader - started on the first image request, decodes through the
+/// backend.
+inline asset_loader_t& asset_loader() {
+  static asset_loader_t loader([](const std::string& path, decoded_image_t& image) {
+    return backend().decode_image(path, image);
   });
-#endif
+  return loader;
+}
+
+/// placeholder_image - white, shown by sprites whose image is still decoding.
+inline uint32_t placeholder_image() {
+  if (!placeholder) {
+    decoded_image_t white;
+    white.width = white.height = 1;
+    white.channels = 4;
+    white.pixels.assign(4, 0xff);
+    placeholder = backend().upload_image(white);
+  }
+  return *placeholder;
+}
+
+struct image_lookup_t {
+  uint32_t image;
+  // where to file the sprites that get image in place of the real one
+  std::vector<uint64_t>* waiting;
+};
+
+inline void store_image(uint32_t asset, uint32_t image) {
+  if (asset >= images.size()) {
+    images.resize(asset + 1);
+  }
+  images[asset] = image;
+}
+
+/// find_image - the uploaded image of asset. An asset seen for the first time
+/// starts decoding in the background and gets the placeholder meanwhile,
+/// unless the asset cache already holds its pixels, e.g. because the compiler
+/// prefetched it.
+inline image_lookup_t find_image(uint32_t asset) {
+  if (asset < images.size() && images[asset]) {
+    return { *images[asset], nullptr };
+  }
+  auto pending = pending_images.find(asset);
+  if (pending == pending_images.end()) {
+    if (auto decoded = asset_loader().request(asset_table().path(asset))) {
+      uint32_t image = backend().upload_image(*decoded);
+      store_image(asset, image);
+      return { image, nullptr };
+    }
+    pending = pending_images.emplace(asset, std::vector<uint64_t>{}).first;
+  }
+  return { placeholder_image(), &pending->second };
+}
+
+/// add_model_instance - loads the model of asset on first use and places
+/// another instance of it.
+inline void add_model_instance(uint32_t asset, double px, double py, double pz, double scale) {
+  if (asset >= loaded_models.size()) {
+    loaded_models.resize(asset + 1);
+  }
+  if (!loaded_models[asset]) {
+    backend().load_model(asset, std::string(fpp_view(asset_table().path(asset))));
+    loaded_models[asset] = true;
+  }
+  backend().add_model_instance(asset, px, py, pz, scale);
+}
+
+/// clear_models - removes every instance, loaded models stay cached.
+inline void clear_models() {
+  backend().clear_models();
+}
+
+/// fpp_asset - the asset table entry of a path only known at run time,
+/// compiled code calls it for 'asset' arguments that are not literals.
+extern "C" DLLEXPORT fpp_asset_t* fpp_asset(const fpp_string_t* path) {
+  return path ? asset_table().slot(*path) : nullptr;
+}
+
+/// fpp_prefetch_asset - code_t::prefetch_asset of the host, starts decoding
+/// the images literal sprite paths name while the script compiles.
+inline void fpp_prefetch_asset(const std::string& callee, const std::string& path) {
+  if (callee.starts_with("sprite")) {
+    asset_loader().request(fpp_make_string(path.c_str(), path.size()));
+  }
+}
+
+/// printd - printf that takes a double prints it as "%f\n", returning 0.
+extern "C" DLLEXPORT double printd(double x) {
+  command_t command;
+  command.type = command_e::print_number;
+  command.print_number = { x };
+  push_command(command);
+  return 0;
+}
+extern "C" DLLEXPORT double printcl(const fpp_string_t* x) {
+  command_t command;
+  command.type = command_e::print_console;
+  command.print = { x };
+  push_command(command);
   return 0;
 }
 
 
-extern "C" DLLEXPORT double string_test(const char* str) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    fan::print(str);
-  });
-#endif
+extern "C" DLLEXPORT double string_test(const fpp_string_t* str) {
+  command_t command;
+  command.type = command_e::print_stdout;
+  command.print = { str };
+  push_command(command);
   return 0;
 }
 
-static int depth = 0;
+/// script_index - x converts to an unsigned integer without undefined
+/// behavior and stays exact: finite, not negative and below 2^53.
+inline bool script_index(double x) {
+  return std::isfinite(x) && x >= 0 && x < 0x1p53;
+}
 
+/// rectangle1 - creates a rectangle, returns its handle.
 extern "C" DLLEXPORT double rectangle1(double px, double py, double sx, double sy, double color, double angle) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    shapes.push_back(fan::graphics::rectangle_t{ {
-        .position = fan::vec3(px, py, depth++),
-        .size = fan::vec2(sx, sx),
-        .color = fan::color::hex((uint32_t)color),
-        .angle = angle
-    } });
-  });
-#endif
-  return 0;
+  uint64_t handle = shape_handles.reserve();
+  command_t command;
+  command.type = command_e::rectangle;
+  command.rectangle = { handle, px, py, sx, sy, angle, (uint32_t)color, false };
+  push_command(command);
+  return (double)handle;
 }
 
 extern "C" DLLEXPORT double rectangle0(double px, double py, double sx, double sy) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    shapes.push_back(fan::graphics::rectangle_t{ {
-       .position = fan::vec3(px, py, depth++),
-       .size = fan::vec2(sx, sx),
-       .color = fan::color::hex((uint32_t)fan::random::color().get_hex())
-   } });
-  });
-#endif
+  uint64_t handle = shape_handles.reserve();
+  command_t command;
+  command.type = command_e::rectangle;
+  command.rectangle = { handle, px, py, sx, sy, 0, 0, true };
+  push_command(command);
+  return (double)handle;
+}
+
+extern "C" DLLEXPORT double sprite2(fpp_asset_t* path, double px, double py, double sx, double sy, double anglex, double angley, double anglez) {
+  uint64_t handle = shape_handles.reserve();
+  command_t command;
+  command.type = command_e::sprite;
+  command.sprite = { handle, fpp_asset_id(path), px, py, sx, sy, { anglex, angley, anglez } };
+  push_command(command);
+  return (double)handle;
+}
+
+/// set_position - moves the shape with handle shape.
+extern "C" DLLEXPORT double set_position(double shape, double px, double py) {
+  // no handle converts from a negative, NaN or huge double
+  if (!script_index(shape)) {
+    return 0;
+  }
+  command_t command;
+  command.type = command_e::set_position;
+  command.set_position = { (uint64_t)shape, px, py };
+  push_command(command);
   return 0;
 }
 
-extern "C" DLLEXPORT double sprite2(const char* cpath, double px, double py, double sx, double sy, double anglex, double angley, double anglez) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=, str = std::string(cpath)] {
-    auto found = images.find(str.c_str());
-    loco_t::image_t image;
-    if (found != images.end()) {
-      image = found->second;
-    }
-    else {
-      image = gloco->image_load(str.c_str());
-      images[str.c_str()] = image;
-    }
-    shapes.push_back(fan::graphics::sprite_t{ {
-        .position = fan::vec3(px, py, depth++),
-        .size = fan::vec2(sx, sx),
-        .angle = fan::vec3(anglex, angley, anglez),
-        .image = image
-    } });
-    //return shapes.back().NRI;
-  });
-#endif
+/// remove_shape - destroys the shape with handle shape, returns 0 when the
+/// handle was not valid.
+extern "C" DLLEXPORT double remove_shape(double shape) {
+  if (!script_index(shape) || !shape_handles.release((uint64_t)shape)) {
+    return 0;
+  }
+  command_t command;
+  command.type = command_e::remove;
+  command.remove = { (uint64_t)shape };
+  push_command(command);
+  return 1;
+}
+extern "C" DLLEXPORT double sprite1(fpp_asset_t* path, double px, double py, double sx, double sy, double angle) {
+  uint64_t handle = shape_handles.reserve();
+  command_t command;
+  command.type = command_e::sprite;
+  command.sprite = { handle, fpp_asset_id(path), px, py, sx, sy, { 0, 0, angle } };
+  push_command(command);
+  return (double)handle;
+}
+
+extern "C" DLLEXPORT double sprite0(fpp_asset_t* path, double px, double py, double sx, double sy) {
+  uint64_t handle = shape_handles.reserve();
+  command_t command;
+  command.type = command_e::sprite;
+  command.sprite = { handle, fpp_asset_id(path), px, py, sx, sy, { 0, 0, 0 } };
+  push_command(command);
+  return (double)handle;
+}
+
+extern "C" DLLEXPORT double model3d(fpp_asset_t* path, double px, double py, double pz, double scale) {
+  command_t command;
+  command.type = command_e::model;
+  command.model = { fpp_asset_id(path), px, py, pz, scale };
+  push_command(command);
   return 0;
 }
 
-extern "C" DLLEXPORT double set_position(double shape, double px, double py) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    decltype(loco_t::shape_t::NRI) nri = shape;
-    (reinterpret_cast<loco_t::shape_t*>(&nri))->set_position(fan::vec2(px, py));
-  });
-#endif
+extern "C" DLLEXPORT double clear() {
+  shape_handles.release_all();
+  command_t command;
+  command.type = command_e::clear;
+  push_command(command);
   return 0;
 }
-extern "C" DLLEXPORT double sprite1(const char* cpath, double px, double py, double sx, double sy, double angle) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=, str = std::string(cpath)] {
-    auto found = images.find(str.c_str());
-    loco_t::image_t image;
-    if (found != images.end()) {
-      image = found->second;
+
+//===----------------------------------------------------------------------===//
+// Bulk calls
+//
+// Create or move many shapes with one command. The data is copied when the
+// call is made, so the caller may reuse its array right away. Shapes created
+// by one call get consecutive handles. Records are consecutive doubles:
+//   rectangles     px py sx sy color angle
+//   sprites        px py sx sy angle
+//   set_positions  shape px py
+//===----------------------------------------------------------------------===//
+
+inline constexpr uint64_t rectangle_stride = 6;
+inline constexpr uint64_t sprite_stride = 5;
+inline constexpr uint64_t position_stride = 3;
+
+struct bulk_block_t {
+  std::vector<double> records;
+};
+
+/// bulk_pool_t - blocks carrying bulk records to the render thread. The
+/// script side takes a block, the render thread hands it back through a
+/// ring once applied, and the block keeps its capacity for the next call,
+/// so queuing a bulk call only allocates while the pool grows. acquire is
+/// called by the thread running the script like shape_handles, release by
+/// fpp_run_tasks.
+struct bulk_pool_t {
+  /// acquire - a block holding at least count doubles.
+  bulk_block_t* acquire(std::size_t count) {
+    returned.drain([this](bulk_block_t* block) {
+      free.push_back(block);
+    });
+    bulk_block_t* block;
+    if (free.empty()) {
+      block = blocks.emplace_back(std::make_unique<bulk_block_t>()).get();
     }
     else {
-      image = gloco->image_load(str.c_str());
-      images[str.c_str()] = image;
+      block = free.back();
+      free.pop_back();
     }
-    shapes.push_back(fan::graphics::sprite_t{ {
-        .position = fan::vec3(px, py, depth++),
-        .size = fan::vec2(sx, sx),
-        .angle = fan::vec3(0, 0, angle),
-        .image = image
-    } });
-  });
-#endif
+    // never shrunk, filling a grown block twice would cost a pass
+    if (block->records.size() < count) {
+      block->records.resize(count);
+    }
+    return block;
+  }
+
+  void release(bulk_block_t* block) {
+    // every block in flight fits, see returned
+    returned.try_push(std::move(block));
+  }
+
+private:
+  // the script side drains it before each new block, so it holds at most
+  // the blocks of one full task queue plus the one being acquired
+  task_ring_t<bulk_block_t*, decltype(task_queue)::capacity() * 2> returned;
+  std::vector<bulk_block_t*> free;
+  std::vector<std::unique_ptr<bulk_block_t>> blocks;
+};
+
+inline bulk_pool_t bulk_pool;
+
+/// push_bulk - queues count records of stride doubles from data, first is
+/// the handle of the first shape they create.
+inline void push_bulk(command_e type, uint64_t first, uint32_t asset, const double* data, uint64_t count, uint64_t stride) {
+  if (count == 0) {
+    return;
+  }
+  command_t command;
+  command.type = type;
+  command.bulk = { bulk_pool.acquire(count * stride), count, first, asset };
+  std::copy(data, data + count * stride, command.bulk.block->records.data());
+  push_command(command);
+}
+
+/// fpp_rectangles - returns the handle of the first rectangle, the others
+/// follow it. 0 when count is 0 or more than the handle table has left.
+extern "C" DLLEXPORT uint64_t fpp_rectangles(const double* data, uint64_t count) {
+  if (count == 0 || count > shape_handles.fresh_left()) {
+    return 0;
+  }
+  uint64_t first = shape_handles.reserve_fresh((uint32_t)count);
+  push_bulk(command_e::rectangles, first, 0, data, count, rectangle_stride);
+  return first;
+}
+
+/// fpp_sprites - sprites showing the image of asset, an id from
+/// asset_table(). Returns the handle of the first sprite, the others follow
+/// it. 0 when count is 0 or more than the handle table has left.
+extern "C" DLLEXPORT uint64_t fpp_sprites(uint32_t asset, const double* data, uint64_t count) {
+  if (count == 0 || count > shape_handles.fresh_left()) {
+    return 0;
+  }
+  uint64_t first = shape_handles.reserve_fresh((uint32_t)count);
+  push_bulk(command_e::sprites, first, asset, data, count, sprite_stride);
+  return first;
+}
+
+extern "C" DLLEXPORT void fpp_set_positions(const double* data, uint64_t count) {
+  push_bulk(command_e::set_positions, 0, 0, data, count, position_stride);
+}
+
+// arrays of doubles scripts fill with buffer_set and hand to the bulk calls,
+// owned by the thread running the script like shape_handles
+inline std::vector<std::vector<double>> buffers;
+
+/// find_buffer - the records [first, first + count) of stride doubles in
+/// buffer id, null when they are out of range.
+inline const double* find_buffer(double id, double first, double count, uint64_t stride) {
+  if (!(id >= 0 && id < buffers.size() && script_index(first) && script_index(count))) {
+    return nullptr;
+  }
+  const std::vector<double>& buffer = buffers[(std::size_t)id];
+  if (((uint64_t)first + (uint64_t)count) * stride > buffer.size()) {
+    return nullptr;
+  }
+  return buffer.data() + (uint64_t)first * stride;
+}
+
+/// buffer - allocates size zeroed doubles, returns the buffer's id.
+extern "C" DLLEXPORT double buffer(double size) {
+  buffers.emplace_back(script_index(size) ? (std::size_t)size : 0);
+  return (double)(buffers.size() - 1);
+}
+
+/// buffer_set - stores value at index, out of range writes are ignored.
+extern "C" DLLEXPORT double buffer_set(double id, double index, double value) {
+  if (id >= 0 && id < buffers.size() && index >= 0 && index < buffers[(std::size_t)id].size()) {
+    buffers[(std::size_t)id][(std::size_t)index] = value;
+  }
   return 0;
 }
 
-extern "C" DLLEXPORT double sprite0(const char* cpath, double px, double py, double sx, double sy) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=, str = std::string(cpath)] {
-    auto found = images.find(str.c_str());
-    loco_t::image_t image;
-    if (found != images.end()) {
-      image = found->second;
-    }
-    else {
-      image = gloco->image_load(str.c_str());
-      images[str.c_str()] = image;
-    }
-    shapes.push_back(fan::graphics::sprite_t{ {
-        .position = fan::vec3(px, py, depth++),
-        .size = fan::vec2(sx, sx),
-        .image = image
-    } });
-  });
-#endif
+/// buffer_get - the value at index, 0 when out of range.
+extern "C" DLLEXPORT double buffer_get(double id, double index) {
+  if (id >= 0 && id < buffers.size() && index >= 0 && index < buffers[(std::size_t)id].size()) {
+    return buffers[(std::size_t)id][(std::size_t)index];
+  }
   return 0;
 }
 
-extern "C" DLLEXPORT double model3d(const char* cpath, double px, double py, double pz, double scale) {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    fan::graphics::model_t::properties_t mp;
-    mp.path = cpath;
-    mp.model = mp.model.translate(fan::vec3(px, py, pz)).scale(scale);
-    models.push_back(mp);
-    gloco->m_pre_draw.push_back([model_id = models.size() - 1] {
-      models[model_id].draw();
-    });
-  });
-#endif
+/// rectangles - creates count rectangles from records first.. of buffer id,
+/// returns the handle of the first one.
+extern "C" DLLEXPORT double rectangles(double id, double first, double count) {
+  if (const double* data = find_buffer(id, first, count, rectangle_stride)) {
+    return (double)fpp_rectangles(data, (uint64_t)count);
+  }
+  return 0;
+}
+
+/// sprites - creates count sprites showing path from records first.. of
+/// buffer id, returns the handle of the first one.
+extern "C" DLLEXPORT double sprites(fpp_asset_t* path, double id, double first, double count) {
+  if (const double* data = find_buffer(id, first, count, sprite_stride)) {
+    return (double)fpp_sprites(fpp_asset_id(path), data, (uint64_t)count);
+  }
   return 0;
 }
 
-inline bool code_sleep = false;
+/// set_positions - moves count shapes as given by records first.. of
+/// buffer id.
+extern "C" DLLEXPORT double set_positions(double id, double first, double count) {
+  if (const double* data = find_buffer(id, first, count, position_stride)) {
+    fpp_set_positions(data, (uint64_t)count);
+  }
+  return 0;
+}
 
-extern "C" DLLEXPORT double clear() {
-#ifndef no_graphics
-  std::lock_guard<std::mutex> lock(task_queue_mutex);
-  task_queue.push_back([=] {
-    shapes.clear();
-  });
+/// reset_buffers - frees the buffers of the previous run.
+inline void reset_buffers() {
+  buffers.clear();
+}
+
+/// store_shape - marks the slot of handle live for the shape the caller
+/// gives the backend, returns the slot.
+inline uint32_t store_shape(uint64_t handle) {
+  uint32_t slot = handle_table_t::slot_of(handle);
+  if (slot >= shapes.size()) {
+    shapes.resize(slot + 1);
+  }
+  shapes[slot] = { handle_table_t::generation_of(handle), true };
+  return slot;
+}
+
+/// live_shape - the backend holds the shape of handle, false if it was
+/// removed or replaced.
+inline bool live_shape(uint64_t handle) {
+  uint32_t slot = handle_table_t::slot_of(handle);
+  return slot < shapes.size() && shapes[slot].live && shapes[slot].generation == handle_table_t::generation_of(handle);
+}
+
+inline void add_rectangle(uint64_t handle, double px, double py, double sx, double sy, uint32_t color, double angle) {
+  backend().add_rectangle(store_shape(handle), px, py, depth++, sx, sy, color, angle);
+}
+
+inline void add_sprite(uint64_t handle, uint32_t image, double px, double py, double sx, double sy, const double (&angle)[3]) {
+  backend().add_sprite(store_shape(handle), image, px, py, depth++, sx, sy, angle);
+}
+
+inline void move_shape(uint64_t handle, double px, double py) {
+  if (live_shape(handle)) {
+    backend().move_shape(handle_table_t::slot_of(handle), px, py);
+  }
+}
+
+/// reset_shapes - removes every shape.
+inline void reset_shapes() {
+  shapes.clear();
   depth = 0;
-#endif
-  return 0;
+  backend().clear_shapes();
 }
 
+/// upload_ready_images - uploads the images the asset workers decoded and
+/// gives them to the sprites that showed the placeholder.
+inline void upload_ready_images() {
+  // drained every frame, images decoded for prefetches or sprites removed
+  // meanwhile are dropped here and live on in the cache only
+  static std::vector<asset_loader_t::ready_t> ready;
+  asset_loader().take_ready(ready);
+  for (auto& decoded : ready) {
+    if (pending_images.empty()) {
+      break;
+    }
+    uint32_t asset = asset_table().intern(fpp_string_t{ decoded.path.c_str(), decoded.path.size(), decoded.hash });
+    auto pending = pending_images.find(asset);
+    if (pending == pending_images.end()) {
+      continue;
+    }
+    // the backend may still load what its decoder could not
+    uint32_t image = decoded.image ? backend().upload_image(*decoded.image) : backend().load_image(decoded.path);
+    for (uint64_t handle : pending->second) {
+      if (live_shape(handle)) {
+        backend().set_image(handle_table_t::slot_of(handle), image);
+      }
+    }
+    pending_images.erase(pending);
+    store_image(asset, image);
+  }
+  ready.clear();
+}
+
+/// run_command - executes one queued library call on the render thread.
+inline void run_command(const command_t& command) {
+  switch (command.type) {
+  case command_e::print_number: {
+    backend().print(std::to_string((uint64_t)command.print_number.value), backend_t::print_e::console);
+    break;
+  }
+  case command_e::print_console: {
+    backend().print(fpp_view(*command.print.text), backend_t::print_e::console);
+    break;
+  }
+  case command_e::print_stdout: {
+    backend().print(fpp_view(*command.print.text), backend_t::print_e::standard_output);
+    break;
+  }
+  case command_e::rectangle: {
+    const auto& r = command.rectangle;
+    add_rectangle(r.handle, r.px, r.py, r.sx, r.sy,
+      r.random_color ? backend().random_color() : r.color, r.angle);
+    break;
+  }
+  case command_e::sprite: {
+    const auto& s = command.sprite;
+    image_lookup_t lookup = find_image(s.asset);
+    add_sprite(s.handle, lookup.image, s.px, s.py, s.sx, s.sy, s.angle);
+    if (lookup.waiting) {
+      lookup.waiting->push_back(s.handle);
+    }
+    break;
+  }
+  case command_e::set_position: {
+    const auto& p = command.set_position;
+    move_shape(p.handle, p.px, p.py);
+    break;
+  }
+  case command_e::model: {
+    const auto& m = command.model;
+    add_model_instance(m.asset, m.px, m.py, m.pz, m.scale);
+    break;
+  }
+  case command_e::clear: {
+    reset_shapes();
+    break;
+  }
+  case command_e::remove: {
+    uint64_t handle = command.remove.handle;
+    if (live_shape(handle)) {
+      shapes[handle_table_t::slot_of(handle)].live = false;
+      backend().remove_shape(handle_table_t::slot_of(handle));
+    }
+    break;
+  }
+  case command_e::rectangles: {
+    const auto& b = command.bulk;
+    uint64_t handle = b.first;
+    shapes.resize(std::max<std::size_t>(shapes.size(), handle_table_t::slot_of(handle) + b.count));
+    for (const double* r = b.block->records.data(), *end = r + b.count * rectangle_stride; r != end; r += rectangle_stride) {
+      add_rectangle(handle++, r[0], r[1], r[2], r[3], (uint32_t)r[4], r[5]);
+    }
+    bulk_pool.release(b.block);
+    break;
+  }
+  case command_e::sprites: {
+    const auto& b = command.bulk;
+    image_lookup_t lookup = find_image(b.asset);
+    uint64_t handle = b.first;
+    shapes.resize(std::max<std::size_t>(shapes.size(), handle_table_t::slot_of(handle) + b.count));
+    for (const double* s = b.block->records.data(), *end = s + b.count * sprite_stride; s != end; s += sprite_stride) {
+      if (lookup.waiting) {
+        lookup.waiting->push_back(handle);
+      }
+      const double angle[3]{ 0, 0, s[4] };
+      add_sprite(handle++, lookup.image, s[0], s[1], s[2], s[3], angle);
+    }
+    bulk_pool.release(b.block);
+    break;
+  }
+  case command_e::set_positions: {
+    const auto& b = command.bulk;
+    for (const double* p = b.block->records.data(), *end = p + b.count * position_stride; p != end; p += position_stride) {
+      if (script_index(p[0])) {
+        move_shape((uint64_t)p[0], p[1], p[2]);
+      }
+    }
+    bulk_pool.release(b.block);
+    break;
+  }
+  }
+}
+
+/// fpp_run_tasks - runs the queued library calls, called by the render loop.
+/// Never blocks: calls queued while it runs wait for the next frame, and a
+/// second caller returns at once.
+extern "C" DLLEXPORT void fpp_run_tasks() {
+  if (task_draining.exchange(true, std::memory_order_acquire)) {
+    return;
+  }
+  task_consumer.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  upload_ready_images();
+  task_queue.drain([](const command_t& command) {
+    run_command(command);
+  });
+  task_draining.store(false, std::memory_order_release);
+}
+
+/// fpp_wait_tasks - blocks until the render loop ran every queued call.
+/// Queued calls can point at string literals of the running code, so wait
+/// before that code is recompiled and its engine released.
+inline void fpp_wait_tasks() {
+  while (!task_queue.empty()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+/// sleep_s - inside a script coroutine only the script waits, the thread
+/// goes on with other coroutines. Outside one the graphics build blocks as
+/// before, headless builds return right away.
 extern "C" DLLEXPORT double sleep_s(double x) {
+  if (!scheduler_t::sleep(x)) {
 #ifndef no_graphics
-  std::this_thread::sleep_for(std::chrono::duration<double>(x));
+    std::this_thread::sleep_for(std::chrono::duration<double>(x));
 #endif
+  }
   return 0;
 }
 
-void clean_up() {
-  code_sleep = false;
-  lib_queue.clear();
-}
\ No newline at end of file
+/// spawn - starts the def name, which takes no arguments, as a coroutine of
+/// its own. Returns 0 when there is no such def or no compiled script runs.
+extern "C" DLLEXPORT double spawn(const fpp_string_t* name) {
+  scheduler_t* scheduler = scheduler_t::current();
+  if (!scheduler || !scheduler->resolve) {
+    return 0;
+  }
+  auto function = reinterpret_cast<double(*)()>(scheduler->resolve(std::string(fpp_view(*name))));
+  if (!function) {
+    return 0;
+  }
+  scheduler->spawn([function] {
+    function();
+  });
+  return 1;
+}
+
+/// register_library - exposes the library to the interpreter tier, which calls
+/// it directly instead of resolving the symbols through the JIT.
+inline void register_library(interpreter_t& interpreter) {
+  interpreter.add_extern<putchard>("putchard");
+  interpreter.add_extern<clamp>("clamp");
+  interpreter.add_extern<lerp>("lerp");
+  interpreter.add_extern<rgb>("rgb");
+  interpreter.add_extern<rgba>("rgba");
+  interpreter.add_extern<radians>("radians");
+  interpreter.add_extern<printd>("printd");
+  interpreter.add_extern<printcl>("printcl");
+  interpreter.add_extern<string_test>("string_test");
+  interpreter.add_extern<rectangle0>("rectangle0");
+  interpreter.add_extern<rectangle1>("rectangle1");
+  interpreter.add_extern<sprite0>("sprite0");
+  interpreter.add_extern<sprite1>("sprite1");
+  interpreter.add_extern<sprite2>("sprite2");
+  interpreter.add_extern<set_position>("set_position");
+  interpreter.add_extern<remove_shape>("remove_shape");
+  interpreter.add_extern<model3d>("model3d");
+  interpreter.add_extern<clear>("clear");
+  interpreter.add_extern<buffer>("buffer");
+  interpreter.add_extern<buffer_set>("buffer_set");
+  interpreter.add_extern<buffer_get>("buffer_get");
+  interpreter.add_extern<rectangles>("rectangles");
+  interpreter.add_extern<sprites>("sprites");
+  interpreter.add_extern<set_positions>("set_positions");
+  interpreter.add_extern<sleep_s>("sleep_s");
+  interpreter.add_extern<spawn>("spawn");
+}
+
+struct runtime_bench_t {
+  uint64_t shapes = 0;
+  // queueing the calls and applying them, per phase
+  double create_seconds = 0;
+  double move_seconds = 0;
+  double bulk_seconds = 0;
+  // what the recording backend held afterwards, 2 * shapes when correct
+  uint64_t live_shapes = 0;
+};
+
+/// bench_runtime - creates and moves count rectangles one call at a time,
+/// then creates count more with one bulk call, all through the command path
+/// into a recording backend. Uses the handles and queue of scripts, so not
+/// while one runs, and becomes the thread running fpp_run_tasks.
+inline runtime_bench_t bench_runtime(uint32_t count) {
+  using clock_t = std::chrono::steady_clock;
+  auto timed = [](auto&& calls) {
+    auto start = clock_t::now();
+    calls();
+    fpp_run_tasks();
+    return std::chrono::duration<double>(clock_t::now() - start).count();
+  };
+
+  recording_backend_t recording;
+  set_backend(&recording);
+  runtime_bench_t bench;
+  bench.shapes = count;
+
+  std::vector<double> handles(count);
+  bench.create_seconds = timed([&] {
+    for (uint32_t i = 0; i < count; ++i) {
+      handles[i] = rectangle0(i, i, 1, 1);
+    }
+  });
+  bench.move_seconds = timed([&] {
+    for (uint32_t i = 0; i < count; ++i) {
+      set_position(handles[i], i + 1, i);
+    }
+  });
+  std::vector<double> records(count * rectangle_stride, 1.0);
+  bench.bulk_seconds = timed([&] {
+    fpp_rectangles(records.data(), count);
+  });
+  bench.live_shapes = recording.live_shapes();
+
+  clear();
+  fpp_run_tasks();
+  set_backend(nullptr);
+  return bench;
+}
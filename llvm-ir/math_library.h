@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+
+#include <llvm/IR/Intrinsics.h>
+
+//===----------------------------------------------------------------------===//
+// Built-in math library - calls to these names are lowered to llvm.*
+// intrinsics instead of opaque extern calls, so LLVM can constant-fold,
+// hoist and vectorize them. A script can still shadow any of them with its
+// own 'def'.
+//===----------------------------------------------------------------------===//
+
+struct math_builtin_t {
+  const char* name;
+  llvm::Intrinsic::ID id;
+  unsigned arity;
+  // host implementation, matches the intrinsic semantics
+  double (*eval)(const double* args);
+};
+
+inline constexpr math_builtin_t math_builtins[] = {
+  { "sqrt",  llvm::Intrinsic::sqrt,   1, [](const double* a) { return std::sqrt(a[0]); } },
+  { "sin",   llvm::Intrinsic::sin,    1, [](const double* a) { return std::sin(a[0]); } },
+  { "cos",   llvm::Intrinsic::cos,    1, [](const double* a) { return std::cos(a[0]); } },
+  { "exp",   llvm::Intrinsic::exp,    1, [](const double* a) { return std::exp(a[0]); } },
+  { "log",   llvm::Intrinsic::log,    1, [](const double* a) { return std::log(a[0]); } },
+  { "fabs",  llvm::Intrinsic::fabs,   1, [](const double* a) { return std::fabs(a[0]); } },
+  { "floor", llvm::Intrinsic::floor,  1, [](const double* a) { return std::floor(a[0]); } },
+  { "ceil",  llvm::Intrinsic::ceil,   1, [](const double* a) { return std::ceil(a[0]); } },
+  { "pow",   llvm::Intrinsic::pow,    2, [](const double* a) { return std::pow(a[0], a[1]); } },
+  { "min",   llvm::Intrinsic::minnum, 2, [](const double* a) { return std::fmin(a[0], a[1]); } },
+  { "max",   llvm::Intrinsic::maxnum, 2, [](const double* a) { return std::fmax(a[0], a[1]); } },
+  { "fma",   llvm::Intrinsic::fma,    3, [](const double* a) { return std::fma(a[0], a[1], a[2]); } },
+};
+
+/// find_math_builtin - returns the builtin for name or nullptr.
+inline const math_builtin_t* find_math_builtin(const std::string& name) {
+  for (const auto& builtin : math_builtins) {
+    if (name == builtin.name) {
+      return &builtin;
+    }
+  }
+  return nullptr;
+}
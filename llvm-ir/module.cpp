@@ -0,0 +1,446 @@
+#include "module.h"
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "run.h"
+#include "codegen.h"
+
+static constexpr const char interface_magic[] = "fpp-interface";
+
+/// write_functions - one 'def' line per exported function.
+static void write_functions(std::ostream& out, const module_interface_t& interface) {
+  out.precision(std::numeric_limits<double>::max_digits10);
+  for (const auto& function : interface.functions) {
+    out << "def " << function.name << ' ' << function.is_operator << ' ' << function.precedence << ' ' << function.args.size();
+    for (std::size_t i = 0; i < function.args.size(); ++i) {
+      out << ' ' << function.arg_types[i] << ' ' << function.args[i];
+    }
+    out << ' ' << function.attributes.size();
+    for (const auto& attribute : function.attributes) {
+      out << ' ' << attribute.name << ' ' << attribute.has_value << ' ' << attribute.value;
+    }
+    out << '\n';
+  }
+}
+
+/// read_function - parses the rest of a 'def' line.
+static bool read_function(std::istream& in, module_interface_t::function_t& function) {
+  std::size_t count = 0;
+  if (!(in >> function.name >> function.is_operator >> function.precedence >> count)) {
+    return false;
+  }
+  function.args.resize(count);
+  function.arg_types.resize(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!(in >> function.arg_types[i] >> function.args[i])) {
+      return false;
+    }
+  }
+  if (!(in >> count)) {
+    return false;
+  }
+  function.attributes.resize(count);
+  for (auto& attribute : function.attributes) {
+    if (!(in >> attribute.name >> attribute.has_value >> attribute.value)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t module_interface_t::hash() const {
+  std::ostringstream out;
+  write_functions(out, *this);
+  return std::hash<std::string>{}(out.str());
+}
+
+module_interface_t make_interface(const std::vector<std::unique_ptr<ast_t::FunctionAST>>& functions) {
+  module_interface_t interface;
+  for (const auto& function : functions) {
+    const auto& proto = function->getProto();
+    if (proto.getName() == "main") {
+      continue;
+    }
+    module_interface_t::function_t exported;
+    exported.name = proto.getName();
+    exported.args = proto.getArgs();
+    exported.arg_types = proto.getArgTypes();
+    exported.is_operator = proto.isUnaryOp() || proto.isBinaryOp();
+    exported.precedence = proto.getBinaryPrecedence();
+    // what the body does, how it is compiled stays private
+    for (const auto& attribute : proto.getAttributes()) {
+      if (attribute.name == "pure" || attribute.name == "nounwind" || attribute.name == "hot" || attribute.name == "cold") {
+        exported.attributes.push_back(attribute);
+      }
+    }
+    interface.functions.push_back(std::move(exported));
+  }
+  return interface;
+}
+
+std::vector<std::string> scan_imports(const std::string& source) {
+  // Follows the lexer: '#' comments run to the end of the line, ''' starts
+  // and ends a block comment, strings are not looked into.
+  std::vector<std::string> imports;
+  std::size_t i = 0;
+  std::size_t size = source.size();
+  auto read_string = [&] {
+    std::size_t end = source.find('"', i + 1);
+    if (end == std::string::npos) {
+      end = size;
+    }
+    std::string value = source.substr(i + 1, end - i - 1);
+    i = std::min(end + 1, size);
+    return value;
+  };
+  while (i < size) {
+    char c = source[i];
+    if (c == '#') {
+      i = source.find_first_of("\r\n", i);
+      if (i == std::string::npos) {
+        break;
+      }
+    }
+    else if (source.compare(i, 3, "'''") == 0) {
+      i = source.find("'''", i + 3);
+      if (i == std::string::npos) {
+        break;
+      }
+      i += 3;
+    }
+    else if (c == '"') {
+      read_string();
+    }
+    else if (std::isalpha((unsigned char)c) || c == '_') {
+      std::size_t start = i;
+      while (i < size && (std::isalnum((unsigned char)source[i]) || source[i] == '_')) {
+        ++i;
+      }
+      if (source.compare(start, i - start, "import") == 0) {
+        while (i < size && std::isspace((unsigned char)source[i])) {
+          ++i;
+        }
+        if (i < size && source[i] == '"') {
+          imports.push_back(read_string());
+        }
+      }
+    }
+    else {
+      ++i;
+    }
+  }
+  return imports;
+}
+
+std::string resolve_import(const std::string& importer, const std::string& module) {
+  namespace fs = std::filesystem;
+  fs::path path(module);
+  if (path.is_relative()) {
+    path = fs::path(importer).parent_path() / path;
+  }
+  std::error_code error;
+  fs::path canonical = fs::weakly_canonical(path, error);
+  return (error ? path.lexically_normal() : canonical).string();
+}
+
+const build_module_t* build_result_t::find(const std::string& path) const {
+  for (const auto& module : modules) {
+    if (module.path == path) {
+      return &module;
+    }
+  }
+  return nullptr;
+}
+
+static bool read_file(const std::string& path, std::string& contents) {
+  std::ifstream file(path, std::ios_base::binary);
+  if (!file) {
+    return false;
+  }
+  contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return true;
+}
+
+static std::string interface_path(const std::string& path) {
+  return path + ".fppi";
+}
+
+std::string module_object_path(const std::string& path) {
+  return path + ".o";
+}
+
+/// load_outputs - reuses the .o and .fppi of a previous build when they were
+/// made from this source against the same import interfaces.
+static bool load_outputs(build_module_t& module, uint64_t source_hash,
+  const std::vector<std::pair<std::string, uint64_t>>& imports) {
+  std::ifstream file(interface_path(module.path));
+  std::string magic;
+  uint64_t hash = 0;
+  if (!file || !(file >> magic >> hash) || magic != interface_magic || hash != source_hash) {
+    return false;
+  }
+
+  std::vector<std::pair<std::string, uint64_t>> recorded;
+  module_interface_t interface;
+  std::string kind;
+  while (file >> kind) {
+    if (kind == "import") {
+      std::pair<std::string, uint64_t> import;
+      if (!(file >> std::quoted(import.first) >> import.second)) {
+        return false;
+      }
+      recorded.push_back(std::move(import));
+    }
+    else if (kind == "def") {
+      interface.functions.emplace_back();
+      if (!read_function(file, interface.functions.back())) {
+        return false;
+      }
+    }
+    else {
+      return false;
+    }
+  }
+  if (recorded != imports) {
+    return false;
+  }
+
+  std::string object;
+  if (!read_file(module_object_path(module.path), object)) {
+    return false;
+  }
+  module.object = std::make_shared<const llvm::SmallVector<char, 0>>(object.begin(), object.end());
+  module.interface = std::move(interface);
+  return true;
+}
+
+/// write_outputs - the object first, an interface file without its object
+/// would be trusted by the next build.
+static bool write_outputs(const build_module_t& module, uint64_t source_hash,
+  const std::vector<std::pair<std::string, uint64_t>>& imports) {
+  {
+    std::ofstream file(module_object_path(module.path), std::ios_base::binary | std::ios_base::trunc);
+    if (!file.write(module.object->data(), module.object->size())) {
+      return false;
+    }
+  }
+  std::ofstream file(interface_path(module.path), std::ios_base::trunc);
+  if (!file) {
+    return false;
+  }
+  file << interface_magic << ' ' << source_hash << '\n';
+  for (const auto& [path, hash] : imports) {
+    file << "import " << std::quoted(path) << ' ' << hash << '\n';
+  }
+  write_functions(file, module.interface);
+  return bool(file);
+}
+
+/// build_one - reuses or compiles module, its imports are already built.
+static void build_one(build_module_t& module, const std::string& source,
+  const std::vector<const build_module_t*>& dependencies, const build_options_t& options) {
+  std::map<std::string, module_interface_t> interfaces;
+  std::vector<std::pair<std::string, uint64_t>> imports;
+  for (std::size_t i = 0; i < dependencies.size(); ++i) {
+    const build_module_t& dependency = *dependencies[i];
+    if (!dependency.compiled) {
+      module.error_log = "Error: import \"" + module.imports[i].first + "\" failed to build\n";
+      return;
+    }
+    interfaces[module.imports[i].first] = dependency.interface;
+    imports.emplace_back(dependency.path, dependency.interface_hash);
+  }
+  std::sort(imports.begin(), imports.end());
+  imports.erase(std::unique(imports.begin(), imports.end()), imports.end());
+
+  uint64_t source_hash = std::hash<std::string>{}(source);
+  if (!options.force && load_outputs(module, source_hash, imports)) {
+    module.compiled = true;
+    module.interface_hash = module.interface.hash();
+    return;
+  }
+
+  code_t code;
+  code.code_input = source;
+  code.code_input.push_back(EOF);
+  code.source_path = module.path;
+  code.aot.object_path = module_object_path(module.path);
+  code.print_ir = false;
+  if (options.configure) {
+    options.configure(code);
+  }
+  // the driver resolved the imports, and tiering and profiles belong to a
+  // running code_t, which a library module never is
+  code.import_modules = false;
+  code.module_interfaces = std::move(interfaces);
+  code.library_module = true;
+  code.aot.output = aot_options_t::object;
+  code.aot.write_object = false;
+  code.tier.enabled = false;
+  code.pgo.enabled = false;
+
+  code.init_code();
+  code.recompile_code();
+  if (!code.debug_info.compiled || !code.object) {
+    module.error_log = code.debug_info.error_log;
+    return;
+  }
+
+  module.object = code.object;
+  module.interface = make_interface(code.functions);
+  module.interface_hash = module.interface.hash();
+  module.rebuilt = true;
+  module.compiled = true;
+  if (!write_outputs(module, source_hash, imports)) {
+    // the build is still usable, the next one starts over
+    module.error_log = "Warning: could not write the outputs of " + module.path + "\n";
+  }
+}
+
+build_result_t build_modules(const std::vector<std::string>& roots, const build_options_t& options) {
+  init_targets();
+  build_result_t result;
+
+  // Depth first over the imports, dependencies land in front of their
+  // importers. A module seen again while its own imports are being visited
+  // closes a cycle.
+  std::map<std::string, std::size_t> index;
+  std::vector<std::string> sources;
+  std::vector<bool> visiting;
+  std::vector<std::string> stack;
+  std::vector<build_module_t> found;
+  std::vector<std::size_t> order;
+  std::function<bool(const std::string&)> visit = [&](const std::string& path) {
+    auto seen = index.find(path);
+    if (seen != index.end()) {
+      if (visiting[seen->second]) {
+        result.error = "Error: import cycle:";
+        auto start = std::find(stack.begin(), stack.end(), path);
+        for (auto it = start; it != stack.end(); ++it) {
+          result.error += " " + *it + " ->";
+        }
+        result.error += " " + path + "\n";
+        return false;
+      }
+      return true;
+    }
+    std::string source;
+    if (!read_file(path, source)) {
+      result.error = "Error: could not open " + path + (stack.empty() ? "" : ", imported by " + stack.back()) + "\n";
+      return false;
+    }
+    std::size_t i = found.size();
+    index[path] = i;
+    found.emplace_back();
+    found[i].path = path;
+    for (const auto& import : scan_imports(source)) {
+      found[i].imports.emplace_back(import, resolve_import(path, import));
+    }
+    sources.push_back(std::move(source));
+    visiting.push_back(true);
+
+    stack.push_back(path);
+    for (std::size_t j = 0; j < found[i].imports.size(); ++j) {
+      // visit grows found, keep a copy of the path
+      std::string import = found[i].imports[j].second;
+      if (!visit(import)) {
+        return false;
+      }
+    }
+    stack.pop_back();
+    visiting[i] = false;
+    order.push_back(i);
+    return true;
+  };
+  for (const auto& root : roots) {
+    if (!visit(resolve_import("", root))) {
+      return result;
+    }
+  }
+
+  // renumber in dependency order
+  std::vector<std::size_t> position(found.size());
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    position[order[i]] = i;
+    result.modules.push_back(std::move(found[order[i]]));
+  }
+  std::vector<std::string> ordered_sources(order.size());
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    ordered_sources[i] = std::move(sources[order[i]]);
+  }
+
+  // A module is ready once all its imports are built; workers take ready
+  // modules until every module is done.
+  std::size_t count = result.modules.size();
+  std::vector<std::vector<const build_module_t*>> dependencies(count);
+  std::vector<std::vector<std::size_t>> importers(count);
+  std::vector<std::size_t> waiting(count, 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    std::vector<std::size_t> unique;
+    for (const auto& import : result.modules[i].imports) {
+      std::size_t dependency = position[index[import.second]];
+      dependencies[i].push_back(&result.modules[dependency]);
+      unique.push_back(dependency);
+    }
+    std::sort(unique.begin(), unique.end());
+    unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+    for (std::size_t dependency : unique) {
+      importers[dependency].push_back(i);
+    }
+    waiting[i] = unique.size();
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::size_t> ready;
+  std::size_t done = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!waiting[i]) {
+      ready.push_back(i);
+    }
+  }
+  auto worker = [&] {
+    std::unique_lock lock(mutex);
+    while (true) {
+      cv.wait(lock, [&] { return !ready.empty() || done == count; });
+      if (ready.empty()) {
+        return;
+      }
+      std::size_t i = ready.back();
+      ready.pop_back();
+      lock.unlock();
+      build_one(result.modules[i], ordered_sources[i], dependencies[i], options);
+      lock.lock();
+      ++done;
+      for (std::size_t importer : importers[i]) {
+        if (!--waiting[importer]) {
+          ready.push_back(importer);
+        }
+      }
+      cv.notify_all();
+    }
+  };
+
+  unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+  threads = (unsigned)std::min<std::size_t>(threads, count);
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < threads; ++i) {
+    pool.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : pool) {
+    thread.join();
+  }
+  return result;
+}
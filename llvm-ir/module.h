@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+
+#include "ast.h"
+
+struct code_t;
+
+//===----------------------------------------------------------------------===//
+// Modules
+//
+// 'import "file.fpp"' makes the defs of another script callable. Every module
+// is compiled on its own into <file>.o, next to it <file>.fppi records the
+// exported prototypes (the interface), the source hash and the interface
+// hash of each import. A module is rebuilt only when its source or the
+// interface of one of its imports changed, so editing a body without
+// touching its prototype rebuilds that module alone. Independent modules
+// compile in parallel, each with its own code_t. Top-level code of an
+// imported module is compiled but never run.
+//===----------------------------------------------------------------------===//
+
+struct module_interface_t {
+  struct function_t {
+    std::string name;
+    std::vector<std::string> args;
+    std::vector<std::string> arg_types;
+    bool is_operator = false;
+    unsigned precedence = 0;
+    // hints callers can use, e.g. '@pure'
+    ast_t::attributes_t attributes;
+  };
+  std::vector<function_t> functions;
+
+  /// hash - changes whenever an importer has to be rebuilt.
+  uint64_t hash() const;
+};
+
+/// make_interface - the defs of a parsed module, main is not exported.
+module_interface_t make_interface(const std::vector<std::unique_ptr<ast_t::FunctionAST>>& functions);
+
+/// scan_imports - the paths of the import statements in source, as written.
+std::vector<std::string> scan_imports(const std::string& source);
+
+/// module_object_path - where the object of the module at path is written.
+std::string module_object_path(const std::string& path);
+
+/// resolve_import - path of module imported by importer, relative imports are
+/// looked up next to the importer.
+std::string resolve_import(const std::string& importer, const std::string& module);
+
+struct build_options_t {
+  // 0 runs one thread per core
+  unsigned threads = 0;
+  // rebuild even when the outputs are up to date
+  bool force = false;
+  // called on every compiler before it parses, e.g. to set fast_math
+  std::function<void(code_t&)> configure;
+};
+
+struct build_module_t {
+  std::string path;
+  // imports as written and the path each resolves to
+  std::vector<std::pair<std::string, std::string>> imports;
+  bool compiled = false;
+  // false when the outputs of a previous build were reused
+  bool rebuilt = false;
+  std::string error_log;
+  std::shared_ptr<const llvm::SmallVector<char, 0>> object;
+  module_interface_t interface;
+  uint64_t interface_hash = 0;
+};
+
+struct build_result_t {
+  // dependencies come before the modules importing them
+  std::vector<build_module_t> modules;
+  // missing files and import cycles
+  std::string error;
+
+  const build_module_t* find(const std::string& path) const;
+};
+
+/// build_modules - builds roots and everything they import.
+build_result_t build_modules(const std::vector<std::string>& roots, const build_options_t& options = {});
@@ -3,6 +3,7 @@
 #include <map>
 
 #include "ast.h"
+#include "module.h"
 
 
 //===----------------------------------------------------------------------===//
@@ -10,6 +11,26 @@
 //===----------------------------------------------------------------------===//
 
 struct parser_t : ast_t {
+  /// functions - every parsed definition in source order, the top level
+  /// expressions end up in 'main'. Code generation and the interpreter both
+  /// run from here once parsing is done.
+  std::vector<std::unique_ptr<FunctionAST>> functions;
+
+  /// pending_attributes - '@' hints parsed but not yet taken by the def,
+  /// extern, for, if or call that follows them.
+  attributes_t pending_attributes;
+
+  /// module_interfaces - exports of the imported modules, keyed by the path
+  /// as written after 'import'. Filled before parsing, see module.h.
+  std::map<std::string, module_interface_t> module_interfaces;
+
+  enum class attribute_target_e {
+    function, // def and extern
+    loop,     // for
+    branch,   // if
+    call
+  };
+
   /// CurTok/getNextToken - Provide a simple token buffer.  CurTok is the current
 /// token the parser is looking at.  getNextToken reads another token from the
 /// lexer and updates CurTok with its results.
@@ -45,6 +66,66 @@ struct parser_t : ast_t {
     return TokPrec;
   }
 
+  /// attributes ::= ('@' identifier ('(' number ')')?)*
+  bool ParseAttributes() {
+    while (CurTok == tok_attribute) {
+      attribute_t Attribute{ identifier_string, 0, false, cursor_location };
+      getNextToken(); // eat the attribute.
+      if (CurTok == '(') {
+        getNextToken(); // eat (.
+        if (CurTok != tok_number) {
+          debug_info.LogError(cursor_location, "expected number in '@" + Attribute.name + "'");
+          return false;
+        }
+        Attribute.value = double_value;
+        Attribute.has_value = true;
+        getNextToken(); // eat the number.
+        if (CurTok != ')') {
+          debug_info.LogError(cursor_location, "expected ')' after '@" + Attribute.name + "' value");
+          return false;
+        }
+        getNextToken(); // eat ).
+      }
+      pending_attributes.push_back(std::move(Attribute));
+    }
+    return true;
+  }
+
+  /// is_known_attribute - the hints each construct understands.
+  static bool is_known_attribute(attribute_target_e target, const std::string& name) {
+    static const std::map<attribute_target_e, std::vector<std::string>> known{
+      { attribute_target_e::function, { "inline", "noinline", "hot", "cold", "pure", "nounwind", "fastmath", "memo" } },
+      { attribute_target_e::loop, { "unroll", "nounroll", "vectorize" } },
+      { attribute_target_e::branch, { "likely", "unlikely" } },
+      { attribute_target_e::call, { "tail" } },
+    };
+    const auto& names = known.at(target);
+    return std::find(names.begin(), names.end(), name) != names.end();
+  }
+
+  /// take_attributes - hands the pending attributes to the construct being
+  /// parsed, reports names it does not understand and contradicting pairs.
+  attributes_t take_attributes(attribute_target_e target) {
+    attributes_t Attributes = std::move(pending_attributes);
+    pending_attributes.clear();
+
+    static constexpr const char* conflicts[][2] = {
+      { "inline", "noinline" }, { "hot", "cold" }, { "unroll", "nounroll" }, { "likely", "unlikely" },
+    };
+    for (const auto& Attribute : Attributes) {
+      if (!is_known_attribute(target, Attribute.name)) {
+        debug_info.LogError(Attribute.loc, "'@" + Attribute.name + "' is not allowed here");
+      }
+    }
+    for (const auto& [first, second] : conflicts) {
+      if (find_attribute(Attributes, first) && find_attribute(Attributes, second)) {
+        debug_info.LogError(find_attribute(Attributes, second)->loc,
+          std::string("'@") + first + "' and '@" + second + "' contradict each other");
+      }
+    }
+    return Attributes;
+  }
+
   /// expression
  ///   ::= unary binoprhs
  ///
@@ -84,10 +165,19 @@ struct parser_t : ast_t {
 
     source_location_t LitLoc = cursor_location;
 
+    // set aside before the arguments, they may carry their own
+    attributes_t Attributes = std::move(pending_attributes);
+    pending_attributes.clear();
+
     getNextToken(); // eat identifier.
 
-    if (CurTok != '(') // Simple variable ref.
+    if (CurTok != '(') { // Simple variable ref.
+      if (!Attributes.empty())
+        return debug_info.LogError(LitLoc, "attributes must precede def, extern, for, if or a call");
       return std::make_unique<VariableExprAST>(LitLoc, IdName);
+    }
+    pending_attributes = std::move(Attributes);
+    Attributes = take_attributes(attribute_target_e::call);
 
     // Call.
     getNextToken(); // eat (
@@ -111,12 +201,15 @@ struct parser_t : ast_t {
     // Eat the ')'.
     getNextToken();
 
-    return std::make_unique<CallExprAST>(LitLoc, IdName, std::move(Args));
+    auto Call = std::make_unique<CallExprAST>(LitLoc, IdName, std::move(Args));
+    Call->setAttributes(std::move(Attributes));
+    return Call;
   }
 
   /// ifexpr ::= 'if' expression 'then' expression 'else' expression
   std::unique_ptr<ExprAST> ParseIfExpr() {
     source_location_t IfLoc = cursor_location;
+    attributes_t Attributes = take_attributes(attribute_target_e::branch);
 
     getNextToken(); // eat the if.
 
@@ -142,12 +235,15 @@ struct parser_t : ast_t {
     if (!Else)
       return nullptr;
 
-    return std::make_unique<IfExprAST>(IfLoc, std::move(Cond), std::move(Then),
+    auto If = std::make_unique<IfExprAST>(IfLoc, std::move(Cond), std::move(Then),
       std::move(Else));
+    If->setAttributes(std::move(Attributes));
+    return If;
   }
 
   /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
   std::unique_ptr<ExprAST> ParseForExpr() {
+    attributes_t Attributes = take_attributes(attribute_target_e::loop);
     getNextToken(); // eat the for.
     if (CurTok != tok_identifier)
       return debug_info.LogError(cursor_location, "expected identifier after for");
@@ -210,8 +306,10 @@ struct parser_t : ast_t {
     if (!Body)
       return nullptr;
 
-    return std::make_unique<ForExprAST>(cursor_location, IdName, std::move(Start), std::move(End),
+    auto For = std::make_unique<ForExprAST>(cursor_location, IdName, std::move(Start), std::move(End),
       std::move(Step), std::move(Body));
+    For->setAttributes(std::move(Attributes));
+    return For;
   }
 
   /// varexpr ::= 'var' identifier ('=' expression)?
@@ -269,7 +367,14 @@ struct parser_t : ast_t {
   ///   ::= ifexpr
   ///   ::= forexpr
   ///   ::= varexpr
+  ///   ::= attributes primary
   std::unique_ptr<ExprAST> ParsePrimary() {
+    if (!pending_attributes.empty() && CurTok != tok_identifier && CurTok != tok_if &&
+      CurTok != tok_for && CurTok != tok_attribute) {
+      pending_attributes.clear();
+      return debug_info.LogError(cursor_location, "attributes must precede def, extern, for, if or a call");
+    }
+
     switch (CurTok) {
     default:
       return debug_info.LogError(cursor_location, "unknown token when expecting an expression");
@@ -285,6 +390,10 @@ struct parser_t : ast_t {
       return ParseForExpr();
     case tok_variable:
       return ParseVarExpr();
+    case tok_attribute:
+      if (!ParseAttributes())
+        return nullptr;
+      return ParsePrimary();
     case tok_eof:
       return nullptr;
     case tok_literal_string: {
@@ -351,10 +460,12 @@ struct parser_t : ast_t {
   }
 
   /// prototype
+  ///   ::= attributes prototype
   ///   ::= id '(' id* ')'
   ///   ::= binary LETTER number? (id, id)
   ///   ::= unary LETTER (id)
   std::unique_ptr<PrototypeAST> ParsePrototype() {
+    attributes_t Attributes = take_attributes(attribute_target_e::function);
     std::string FnName;
     source_location_t FnLoc = cursor_location;
     unsigned Kind = 0;
@@ -410,6 +521,9 @@ struct parser_t : ast_t {
       else if (CurTok == tok_type_double) {
         ArgType = "double";  // Recognize double type
       }
+      else if (CurTok == tok_type_asset) {
+        ArgType = "asset";  // a path the compiler resolves, see asset_table.h
+      }
       else if (CurTok == tok_identifier) {
         ArgNames.push_back(identifier_string);  // Store the argument name
         ArgTypes.push_back("double");  // Store the argument type
@@ -445,7 +559,11 @@ struct parser_t : ast_t {
     if (Kind && ArgNames.size() != Kind)
       return debug_info.LogErrorP(cursor_location, "Invalid number of operands for operator");
 
-    return std::make_unique<PrototypeAST>(FnLoc, FnName, ArgNames, ArgTypes, Kind != 0, BinaryPrecedence);
+    auto Proto = std::make_unique<PrototypeAST>(FnLoc, FnName, ArgNames, ArgTypes, Kind != 0, BinaryPrecedence);
+    // the module switch opts every prototype in, @fastmath just this one
+    Proto->setFastMath(fast_math || find_attribute(Attributes, "fastmath"));
+    Proto->setAttributes(std::move(Attributes));
+    return Proto;
   }
 
   /// definition ::= 'def' prototype expression
@@ -519,9 +637,8 @@ struct parser_t : ast_t {
 
   void HandleDefinition() {
     if (auto FnAST = ParseDefinition()) {
-      if (!FnAST->codegen(this)) {
-        debug_info.LogError(cursor_location, "Error reading function definition:");
-      }
+      script_defs.insert(FnAST->getName());
+      functions.push_back(std::move(FnAST));
     }
     else {//
       // Skip token for error recovery.
@@ -530,13 +647,9 @@ struct parser_t : ast_t {
   }
 
   void HandleExtern() {
+    // The declaration is emitted on first use, see getFunction.
     if (auto ProtoAST = ParseExtern()) {
-      if (!ProtoAST->codegen(this)) {
-        debug_info.LogError(cursor_location, "Error reading extern");
-      }
-      else {
-        FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
-      }
+      FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
     }
     else {
       // Skip token for error recovery.
@@ -544,6 +657,34 @@ struct parser_t : ast_t {
     }
   }
 
+  /// import ::= 'import' string
+  void HandleImport() {
+    source_location_t ImportLoc = cursor_location;
+    getNextToken(); // eat import.
+    if (CurTok != tok_literal_string) {
+      debug_info.LogError(cursor_location, "Expected module path after import");
+      return;
+    }
+    // The module was built before parsing started, its defs are declared
+    // like externs.
+    auto Found = module_interfaces.find(string_value);
+    if (Found == module_interfaces.end()) {
+      debug_info.LogError(ImportLoc, "module \"" + string_value + "\" was not built");
+      getNextToken();
+      return;
+    }
+    for (const auto& Export : Found->second.functions) {
+      auto Proto = std::make_unique<PrototypeAST>(ImportLoc, Export.name, Export.args, Export.arg_types,
+        Export.is_operator, Export.precedence);
+      Proto->setAttributes(Export.attributes);
+      if (Proto->isBinaryOp())
+        BinopPrecedence[Proto->getOperatorName()] = Proto->getBinaryPrecedence();
+      FunctionProtos[Export.name] = std::move(Proto);
+      script_defs.insert(Export.name);
+    }
+    getNextToken(); // eat the path.
+  }
+
   void HandleTopLevelExpression() {
     // Evaluate all top-level expressions
     auto expressions = ParseTopLevelExpr();
@@ -551,6 +692,7 @@ struct parser_t : ast_t {
     // Create a prototype for 'main'
     auto Proto = std::make_unique<PrototypeAST>(
       cursor_location, "main", std::vector<std::string>(), std::vector<std::string>());
+    Proto->setFastMath(fast_math);
 
     // Combine expressions into a single body
     std::vector<std::unique_ptr<ExprAST>> BodyExpressions;
@@ -559,15 +701,16 @@ struct parser_t : ast_t {
     }
     auto Body = std::make_unique<CompoundExprAST>(cursor_location, std::move(BodyExpressions));
 
-    auto fn_ast = std::make_unique<FunctionAST>(std::move(Proto), std::move(Body));
-    if (fn_ast) {
-      if (!fn_ast->codegen(this)) {
-        debug_info.LogError(cursor_location, "Error generating code for top level expr");
+    functions.push_back(std::make_unique<FunctionAST>(std::move(Proto), std::move(Body)));
+  }
+
+  /// HandleCodegen - emits every parsed function into TheModule.
+  void HandleCodegen() {
+    for (auto& FnAST : functions) {
+      if (!FnAST->codegen(this)) {
+        debug_info.LogError({ FnAST->getProto().getLine(), 0 },
+          "Error generating code for function " + FnAST->getName());
       }
     }
-    else {
-      // Skip token for error recovery.
-      getNextToken();
-    }
   }
 };
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "pgo.h"
+
+#include <fstream>
+
+#include <llvm/IR/Module.h>
+#include <llvm/IR/ProfileSummary.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+
+using namespace llvm;
+
+static constexpr const char profile_magic[] = "fpp-profile";
+
+uint64_t profile_key(uint64_t source_hash, std::initializer_list<uint64_t> settings) {
+  uint64_t key = source_hash;
+  for (uint64_t setting : settings) {
+    key ^= setting + 0x9e3779b97f4a7c15ull + (key << 6) + (key >> 2);
+  }
+  return key;
+}
+
+bool load_profile(const std::string& path, uint64_t key, profile_t& profile) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  std::string magic;
+  uint64_t hash = 0;
+  if (!(file >> magic >> hash) || magic != profile_magic || hash != key) {
+    return false;
+  }
+  profile.clear();
+  std::string function;
+  std::size_t count;
+  while (file >> function >> count) {
+    auto& counters = profile[function];
+    counters.resize(count);
+    for (auto& counter : counters) {
+      file >> counter;
+    }
+  }
+  return true;
+}
+
+bool save_profile(const std::string& path, uint64_t key, const profile_t& profile) {
+  std::ofstream file(path, std::ios_base::trunc);
+  if (!file) {
+    return false;
+  }
+  file << profile_magic << ' ' << key << '\n';
+  for (const auto& [function, counters] : profile) {
+    file << function << ' ' << counters.size();
+    for (uint64_t counter : counters) {
+      file << ' ' << counter;
+    }
+    file << '\n';
+  }
+  return true;
+}
+
+void set_profile_summary(Module& module, const profile_t& profile) {
+  InstrProfSummaryBuilder builder(ProfileSummaryBuilder::DefaultCutoffs);
+  for (const auto& [function, counters] : profile) {
+    if (counters.empty()) {
+      continue;
+    }
+    builder.addEntryCount(counters[0]);
+    for (std::size_t i = 1; i < counters.size(); ++i) {
+      builder.addInternalCount(counters[i]);
+    }
+  }
+  module.setProfileSummary(builder.getSummary()->getMD(module.getContext()), ProfileSummary::PSK_Instr);
+}
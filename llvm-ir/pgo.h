@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Module;
+}
+
+//===----------------------------------------------------------------------===//
+// Profile guided optimization
+//
+// The instrumented build counts function entries (counter 0) and both edges
+// of every if/for branch (two counters per site, in codegen order). When the
+// code is released, after main and every update call ran, the counts are
+// saved next to the source as '<file>.profdata'; the next compile under the
+// same key applies them as entry counts, branch weights and hot/cold
+// attributes before running the optimizer. A function whose counter count
+// differs from its profile entry gets none of it.
+//
+// The counters are plain globals rather than LLVM's InstrProf runtime
+// (PGOInstrumentationGen/Use): the JIT has no profile runtime to link, and
+// slots numbered by the AST stay stable across the O0 and optimized builds.
+//===----------------------------------------------------------------------===//
+
+using profile_t = std::map<std::string, std::vector<uint64_t>>;
+
+/// profile_key - source_hash mixed with the settings that shape the AST
+/// codegen numbers counters on, e.g. the AST optimizer's.
+uint64_t profile_key(uint64_t source_hash, std::initializer_list<uint64_t> settings);
+
+/// load_profile - reads path into profile, fails if the file is missing or
+/// was recorded under a different key.
+bool load_profile(const std::string& path, uint64_t key, profile_t& profile);
+bool save_profile(const std::string& path, uint64_t key, const profile_t& profile);
+
+/// set_profile_summary - attaches an instrumentation profile summary so
+/// hotness queries (inlining, splitting, layout) see the counts.
+void set_profile_summary(llvm::Module& module, const profile_t& profile);
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "backend.h"
+
+//===----------------------------------------------------------------------===//
+// Recording backend
+//
+// Applies commands to an in-memory scene instead of the GPU. Headless builds
+// use it by default, and other builds can switch to it with set_backend. It
+// runs the same command path a window does, so CI machines without a GPU
+// can test and benchmark it. Images are never read from disk: an image is
+// recorded as 1x1 and remembers its path. Colors come from a counter, so
+// the same script always produces the same scene once the asset loader is
+// idle and its images are applied.
+//===----------------------------------------------------------------------===//
+
+struct recording_backend_t : backend_t {
+  struct shape_t {
+    enum kind_e : uint8_t {
+      none,
+      rectangle,
+      sprite
+    };
+    kind_e kind = none;
+    double px = 0, py = 0, depth = 0, sx = 0, sy = 0;
+    double angle[3]{};
+    uint32_t color = 0;
+    uint32_t image = 0;
+  };
+  struct image_t {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // "-" for images uploaded from pixels, e.g. the placeholder
+    std::string path = "-";
+  };
+  struct model_t {
+    std::string path;
+    // px py pz scale of every instance
+    std::vector<double> instances;
+  };
+  struct counters_t {
+    uint64_t prints = 0;
+    uint64_t shapes_created = 0;
+    uint64_t moves = 0;
+    uint64_t image_changes = 0;
+    uint64_t removes = 0;
+    uint64_t image_uploads = 0;
+    uint64_t model_loads = 0;
+    uint64_t model_instances = 0;
+  };
+
+  // by handle slot
+  std::vector<shape_t> shapes;
+  // by image id
+  std::vector<image_t> images;
+  // by asset id, path empty until loaded
+  std::vector<model_t> models;
+  std::vector<std::string> output;
+  counters_t counters;
+  uint32_t next_color = 0;
+
+  void print(std::string_view text, print_e target) override {
+    ++counters.prints;
+    output.emplace_back(text);
+  }
+
+  uint32_t random_color() override {
+    // a counter scrambled by a large odd constant, always opaque
+    return (++next_color * 0x9e3779b1u) | 0xff;
+  }
+
+  void add_rectangle(uint32_t slot, double px, double py, double depth, double sx, double sy, uint32_t color, double angle) override {
+    shape_t& shape = store(slot);
+    shape.kind = shape_t::rectangle;
+    shape.px = px, shape.py = py, shape.depth = depth, shape.sx = sx, shape.sy = sy;
+    shape.angle[0] = shape.angle[1] = 0, shape.angle[2] = angle;
+    shape.color = color;
+  }
+
+  void add_sprite(uint32_t slot, uint32_t image, double px, double py, double depth, double sx, double sy, const double (&angle)[3]) override {
+    shape_t& shape = store(slot);
+    shape.kind = shape_t::sprite;
+    shape.px = px, shape.py = py, shape.depth = depth, shape.sx = sx, shape.sy = sy;
+    std::copy(angle, angle + 3, shape.angle);
+    shape.image = image;
+  }
+
+  void move_shape(uint32_t slot, double px, double py) override {
+    ++counters.moves;
+    shapes[slot].px = px;
+    shapes[slot].py = py;
+  }
+
+  void set_image(uint32_t slot, uint32_t image) override {
+    ++counters.image_changes;
+    shapes[slot].image = image;
+  }
+
+  void remove_shape(uint32_t slot) override {
+    ++counters.removes;
+    shapes[slot] = shape_t{};
+  }
+
+  void clear_shapes() override {
+    shapes.clear();
+  }
+
+  // nothing to decode, load_image records the path instead
+  bool decode_image(const std::string& path, decoded_image_t& image) override {
+    return false;
+  }
+
+  uint32_t upload_image(const decoded_image_t& image) override {
+    ++counters.image_uploads;
+    images.push_back({ image.width, image.height });
+    return (uint32_t)images.size() - 1;
+  }
+
+  uint32_t load_image(const std::string& path) override {
+    ++counters.image_uploads;
+    images.push_back({ 1, 1, path });
+    return (uint32_t)images.size() - 1;
+  }
+
+  void load_model(uint32_t asset, const std::string& path) override {
+    ++counters.model_loads;
+    if (asset >= models.size()) {
+      models.resize(asset + 1);
+    }
+    models[asset].path = path;
+  }
+
+  void add_model_instance(uint32_t asset, double px, double py, double pz, double scale) override {
+    ++counters.model_instances;
+    models[asset].instances.insert(models[asset].instances.end(), { px, py, pz, scale });
+  }
+
+  void clear_models() override {
+    for (auto& model : models) {
+      model.instances.clear();
+    }
+  }
+
+  /// live_shapes - shapes currently in the scene.
+  std::size_t live_shapes() const {
+    std::size_t count = 0;
+    for (const auto& shape : shapes) {
+      count += shape.kind != shape_t::none;
+    }
+    return count;
+  }
+
+  /// dump - one line per live shape and model instance, then the printed
+  /// text. Equal scenes give equal text, which is what regression tests diff.
+  std::string dump() const {
+    std::string text;
+    char line[256];
+    for (std::size_t slot = 0; slot < shapes.size(); ++slot) {
+      const shape_t& s = shapes[slot];
+      if (s.kind == shape_t::rectangle) {
+        std::snprintf(line, sizeof(line), "rectangle %zu pos %g %g %g size %g %g color %08x angle %g\n",
+          slot, s.px, s.py, s.depth, s.sx, s.sy, s.color, s.angle[2]);
+        text += line;
+      }
+      else if (s.kind == shape_t::sprite) {
+        const image_t& image = images[s.image];
+        std::snprintf(line, sizeof(line), "sprite %zu pos %g %g %g size %g %g angle %g %g %g image %ux%u %s\n",
+          slot, s.px, s.py, s.depth, s.sx, s.sy, s.angle[0], s.angle[1], s.angle[2],
+          image.width, image.height, image.path.c_str());
+        text += line;
+      }
+    }
+    for (const auto& model : models) {
+      for (std::size_t i = 0; i < model.instances.size(); i += 4) {
+        std::snprintf(line, sizeof(line), "model %s pos %g %g %g scale %g\n", model.path.c_str(),
+          model.instances[i], model.instances[i + 1], model.instances[i + 2], model.instances[i + 3]);
+        text += line;
+      }
+    }
+    for (const auto& printed : output) {
+      text += "print " + printed + "\n";
+    }
+    return text;
+  }
+
+private:
+  shape_t& store(uint32_t slot) {
+    ++counters.shapes_created;
+    if (slot >= shapes.size()) {
+      shapes.resize(slot + 1);
+    }
+    return shapes[slot];
+  }
+};
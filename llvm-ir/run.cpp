@@ -1,32 +1,56 @@
 #include "run.h"
 
-#include "../include/KaleidoscopeJIT.h"
+#include <atomic>
+
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
-#include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/TargetParser/Host.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/MC/TargetRegistry.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/TargetParser/SubtargetFeature.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/MemoryBuffer.h>
 
 #include "parser.h"
 #include "codegen.h"
+#include "pgo.h"
+#include "ast_optimizer.h"
 
 using namespace llvm;
 
+code_t::~code_t() {
+  release_entry_points();
+  // optimized tiers and the engine reference the module's context
+  tiering.stop();
+  engine.reset();
+  if (object_write.valid()) {
+    object_write.wait();
+  }
+}
+
 void code_t::init_code() {
-  InitializeNativeTarget();
-  InitializeNativeTargetAsmPrinter();
-  InitializeNativeTargetAsmParser();
+  init_parser();
+  init_llvm();
+}
 
+void code_t::init_parser() {
+  // update belongs to the code being replaced
+  release_entry_points();
   debug_info.init();
 
-  TheContext = std::unique_ptr<LLVMContext>{};
-  TheModule = std::unique_ptr<Module>{};
-  FunctionProtos = std::map<std::string, std::unique_ptr<ast_t::PrototypeAST>>{};
+  // the lexer consumes code_input, hash it for the profile first
+  pgo.source_hash = std::hash<std::string>{}(code_input);
 
-  codegen_init();
+  functions.clear();
+  FunctionProtos = std::map<std::string, std::unique_ptr<ast_t::PrototypeAST>>{};
+  script_defs.clear();
+  pending_attributes.clear();
 
   identifier_string = std::string(); // Filled in if tok_identifier
   double_value = double();             // Filled in if tok_number
@@ -39,13 +63,49 @@ void code_t::init_code() {
 
   // Prime the first token.
   getNextToken();
+}
+
+void code_t::init_llvm() {
+  init_targets();
+
+  // update may run tiered code, stop calling it first
+  release_entry_points();
+  tiering.stop();
+  tiering.log = debug_cb;
+  tier.reset();
+  tier.active = tier.enabled && aot.output == aot_options_t::object && !aot.write_object;
+  memo.reset();
+  tier_bitcode.clear();
+  // the running script keeps the plain names, see memo_counters
+  symbol_scope = library_module ? "fpp.module." + std::to_string(std::hash<std::string>{}(source_path)) + "." : "";
+
+  // Instrument until a profile recorded for this exact source exists. The
+  // counters are numbered on the optimized AST, its settings are part of the
+  // key.
+  uint64_t source_hash = pgo.source_hash;
+  pgo.reset();
+  pgo.source_hash = source_hash;
+  pgo.key = profile_key(source_hash, { optimize_ast, ast_optimizer_t::default_step_budget, ast_optimizer_t::default_depth_limit,
+    ast_optimizer_t::default_stack_limit });
+  if (pgo.enabled) {
+    pgo.mode = load_profile(profile_path(), pgo.key, pgo.profile) ?
+      pgo_info_t::use : pgo_info_t::generate;
+  }
 
-  create_the_JIT();
+  // the engine owns the previous module, both live in the previous context
+  engine.reset();
+  object.reset();
+  DBuilder.reset();
+  string_pool.clear();
+  asset_pool.clear();
+  TheModule = std::unique_ptr<Module>{};
+  ir_builder.reset();
+  TheContext = std::unique_ptr<LLVMContext>{};
 
-  init_module();
+  init_module(this);
 
   TheModule = std::make_unique<Module>("my cool jit", *TheContext);
-  TheModule->setDataLayout(get_JIT()->getDataLayout());
+  TheModule->setDataLayout(host_data_layout());
 
   // Add the current debug info version into the module.
   TheModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
@@ -80,7 +140,8 @@ void code_t::init_code() {
     }
     {
       std::vector<std::string> Args{ "x" }; // parameter names
-      std::vector<Type*> params(Args.size(), PointerType::getUnqual(Type::getInt8Ty(*TheContext)));
+      // const fpp_string_t*
+      std::vector<Type*> params(Args.size(), PointerType::getUnqual(*TheContext));
       FunctionType* FT =
         FunctionType::get(Type::getDoubleTy(*TheContext), params, false);
 
@@ -100,12 +161,15 @@ void code_t::init_code() {
 }
 
 /// top ::= definition | external | expression | ';'
+/// Parses the whole input into functions, nothing is generated yet.
 void code_t::main_loop() {
-  while (true) {
+  bool parsing = true;
+  while (parsing) {
     switch (CurTok) {
     case tok_eof:
       code_input.clear(); // clear buffer
-      return;
+      parsing = false;
+      break;
     case ';': // ignore top-level semicolons.
       getNextToken();
       break;
@@ -115,78 +179,150 @@ void code_t::main_loop() {
     case tok_extern:
       HandleExtern();
       break;
+    case tok_import:
+      HandleImport();
+      break;
+    case tok_attribute:
+      // taken by the def, extern or expression that follows
+      if (!ParseAttributes())
+        getNextToken(); // Skip token for error recovery.
+      break;
     case 0: {
-      return;
+      parsing = false;
+      break;
     }
     default:
       HandleTopLevelExpression();
       break;
     }
   }
-}
 
+  if (optimize_ast && debug_info.compiled) {
+    ast_optimizer_t optimizer;
+    for (const auto& [name, proto] : FunctionProtos) {
+      if (proto->getAttribute("pure"))
+        optimizer.pure_calls.insert(name);
+    }
+    for (const auto& function : functions) {
+      if (function->getProto().getAttribute("pure"))
+        optimizer.pure_calls.insert(function->getName());
+    }
+    optimizer.run(functions);
+    const auto& stats = optimizer.stats;
+    debug_cb("ast: folded " + std::to_string(stats.folded) + ", pruned " + std::to_string(stats.pruned) +
+      ", propagated " + std::to_string(stats.propagated) + ", cse " + std::to_string(stats.cse) +
+      ", evaluated " + std::to_string(stats.evaluated), 0);
+  }
+}
 
-int code_t::run_code() {
 
-  if (debug_info.compiled == false) {
-    // flag 1 corresponds to error - uses fan console highlight enum
-    debug_cb(debug_info.error_log, 1);
-    debug_cb("Failed to compile", 1);
-    TheModule.reset();// idk why this needs to be here, otherwise corruption, maybe destruction order?
-    return 1;
+bool code_t::create_engine() {
+  if (!object) {
+    errs() << "No object code to load, compile first.\n";
+    return false;
   }
 
-  // Create the JIT engine and move the module into it
+  // The code was already generated by emit_object, the engine only links
+  // that object in memory. It still needs a module to be created from.
   std::string ErrorStr;
-  std::unique_ptr<ExecutionEngine> EE(
-    EngineBuilder(std::move(TheModule))
+  engine.reset(
+    EngineBuilder(std::make_unique<Module>("fpp.jit", *TheContext))
     .setErrorStr(&ErrorStr)
-    .setOptLevel(CodeGenOptLevel::Default)
+    .setOptLevel(CodeGenOptLevel::None)
     .create()
   );
+  auto& EE = engine;
 
   if (!EE) {
     errs() << "Failed to create ExecutionEngine: " << ErrorStr << "\n";
-    return 1;
+    return false;
   }
 
-  //{
-  //  using namespace object;
-  //  std::string objectFileName("a.o");
-
-  //  ErrorOr<std::unique_ptr<MemoryBuffer>> buffer =
-  //    MemoryBuffer::getFile(objectFileName.c_str());
-
-  //  if (!buffer) {
-  //    fan::throw_error("failed to open file");
-  //  }
+  if (tier.active) {
+    EE->addGlobalMapping("fpp_tier_up", reinterpret_cast<uint64_t>(&fpp_tier_up));
+    EE->addGlobalMapping("fpp.tier.state", reinterpret_cast<uint64_t>(&tiering));
+  }
 
-  //  Expected<std::unique_ptr<ObjectFile>> objectOrError =
-  //    ObjectFile::createObjectFile(buffer.get()->getMemBufferRef());
+  // the objects outlive the engine, init_llvm releases the engine first
+  auto AddObject = [&EE](const SmallVector<char, 0>& Bytes, StringRef Name) {
+    using llvm::object::ObjectFile;
+    using llvm::object::OwningBinary;
+    auto Buffer = MemoryBuffer::getMemBuffer(StringRef(Bytes.data(), Bytes.size()), Name, false);
+    Expected<std::unique_ptr<ObjectFile>> ObjectOrError = ObjectFile::createObjectFile(Buffer->getMemBufferRef());
+    if (!ObjectOrError) {
+      errs() << "Failed to load object: " << toString(ObjectOrError.takeError()) << "\n";
+      return false;
+    }
+    EE->addObjectFile(OwningBinary<ObjectFile>(std::move(*ObjectOrError), std::move(Buffer)));
+    return true;
+  };
+  // imported modules resolve against each other and the script when the
+  // engine finalizes
+  bool Loaded = AddObject(*object, "fpp.o");
+  for (const auto& Linked : linked_objects) {
+    Loaded = Loaded && AddObject(*Linked, "fpp.module.o");
+  }
+  if (!Loaded) {
+    engine.reset();
+    return false;
+  }
 
-  //  if (!objectOrError) {
-  //    fan::throw_error("failed to open file");
-  //  }
+  EE->finalizeObject();
 
-  //  std::unique_ptr<ObjectFile> objectFile(std::move(objectOrError.get()));
+  if (tier.active) {
+    tiering.start(EE.get(), std::move(tier_bitcode), tier.functions);
+  }
+  return true;
+}
 
-  //  auto owningObject = OwningBinary<ObjectFile>(std::move(objectFile),
-  //    std::move(buffer.get()));
+int code_t::run_code() {
 
-  //  EE->addObjectFile(std::move(owningObject));
-  //}
+  if (debug_info.compiled == false) {
+    // flag 1 corresponds to error - uses fan console highlight enum
+    debug_cb(debug_info.error_log, 1);
+    debug_cb("Failed to compile", 1);
+    TheModule.reset();// idk why this needs to be here, otherwise corruption, maybe destruction order?
+    return 1;
+  }
 
-  EE->finalizeObject();
+  if (!create_engine()) {
+    return 1;
+  }
+  auto& EE = engine;
 
-  // Assuming you have a function named 'main' to execute
-  Function* MainFn = EE->FindFunctionNamed("main");
+  // linked output renames the script's main, see emit_object
+  const char* Entry = aot.output == aot_options_t::object ? "main" : "fpp_main";
+  auto MainFn = reinterpret_cast<double(*)()>(EE->getFunctionAddress(Entry));
   if (!MainFn) {
     errs() << "'main' function not found in module.\n";
+    tiering.stop();
     return 1;
   }
+  // a running main is never swapped, its loops stay at tier 0 unless the
+  // host asked for an optimized main and waits for it here
+  if (tier.active && tier.optimize_main && tier.main_loops) {
+    if (uint64_t Optimized = tiering.compile_now(Entry)) {
+      MainFn = reinterpret_cast<double(*)()>(Optimized);
+    }
+  }
 
-  std::vector<GenericValue> NoArgs;
-  GenericValue GV = EE->runFunction(MainFn, NoArgs);
+  // the host may be polling the scheduler already
+  std::lock_guard<std::recursive_mutex> lock(entry_mutex);
+  scheduler.resolve = [this](const std::string& name) {
+    return reinterpret_cast<void*>(find_def(name, 0));
+  };
+  scheduler.spawn([this, MainFn] {
+    MainFn();
+    finish_main();
+  });
+  if (!cooperative) {
+    scheduler.run();
+  }
+  else {
+    // main runs on the calling thread until it first sleeps, so a script
+    // that computes without sleeping never stalls the thread polling it
+    scheduler.poll();
+  }
   //  std::stringstream oss;
     // oss << "Result: " << std::fixed << std::setprecision(0) << GV.DoubleVal << std::endl;
     // Print the result
@@ -195,19 +331,231 @@ int code_t::run_code() {
   return 0;
 }
 
+void code_t::finish_main() {
+  entry_points_t entries;
+  entries.init = reinterpret_cast<double(*)()>(find_def("init", 0));
+  entries.update = reinterpret_cast<double(*)(double)>(find_def("update", 1));
+  if (entries.update) {
+    entries.update_slot = find_slot("update");
+  }
+  if (entries.init) {
+    entries.init();
+  }
+  {
+    std::lock_guard<std::recursive_mutex> lock(entry_mutex);
+    entry_points = entries;
+  }
+
+  for (const auto& Table : memo.tables) {
+    uint64_t Hits = 0, Misses = 0;
+    if (memo_counters(Table.function, Hits, Misses)) {
+      debug_cb("memo " + Table.function + ": " + std::to_string(Hits) + " hits, " + std::to_string(Misses) + " misses", 0);
+    }
+  }
+
+  // update keeps counting, release_entry_points saves the profile
+  pgo.counted = true;
+}
+
+void code_t::save_counters() {
+  if (pgo.mode != pgo_info_t::generate || !pgo.counted || !engine) {
+    return;
+  }
+  pgo.counted = false;
+  profile_t profile;
+  for (const auto& [function, slots] : pgo.slots) {
+    profile[function].resize(slots);
+  }
+  for (const auto& [function, slot] : pgo.counters) {
+    auto& counters = profile[function];
+    uint64_t address = engine->getGlobalValueAddress(scoped("fpp.prof." + function + "." + std::to_string(slot)));
+    if (slot < counters.size() && address) {
+      counters[slot] = *reinterpret_cast<uint64_t*>(address);
+    }
+  }
+  if (save_profile(profile_path(), pgo.key, profile)) {
+    debug_cb("Saved profile to " + profile_path(), 0);
+  }
+  else {
+    debug_cb("Failed to save profile to " + profile_path(), 1);
+  }
+}
+
+uint64_t code_t::find_def(const std::string& name, std::size_t arity) {
+  // entry points and spawned coroutines are plain defs taking doubles
+  for (const auto& function : functions) {
+    const auto& types = function->getProto().getArgTypes();
+    if (function->getName() == name && types.size() == arity &&
+      std::all_of(types.begin(), types.end(), [](const std::string& type) { return type == "double"; })) {
+      if (uint64_t* slot = find_slot(name)) {
+        return std::atomic_ref<uint64_t>(*slot).load(std::memory_order_acquire);
+      }
+      return engine->getFunctionAddress(name);
+    }
+  }
+  return 0;
+}
+
+uint64_t* code_t::find_slot(const std::string& name) {
+  if (!tier.active || !tier.index.count(name)) {
+    return nullptr;
+  }
+  return reinterpret_cast<uint64_t*>(engine->getGlobalValueAddress(name + ".slot"));
+}
+
+bool code_t::call_update(double dt) {
+  std::unique_lock<std::recursive_mutex> lock(entry_mutex, std::try_to_lock);
+  if (!lock || !entry_points.update) {
+    return false;
+  }
+  auto update = entry_points.update;
+  if (entry_points.update_slot) {
+    // tier-up may have patched the slot since the last frame
+    update = reinterpret_cast<double(*)(double)>(
+      std::atomic_ref<uint64_t>(*entry_points.update_slot).load(std::memory_order_acquire));
+  }
+  update(dt);
+  return true;
+}
+
+bool code_t::poll_scripts() {
+  std::unique_lock<std::recursive_mutex> lock(entry_mutex, std::try_to_lock);
+  if (!lock) {
+    return false;
+  }
+  scheduler.poll();
+  return true;
+}
+
+void code_t::release_entry_points() {
+  std::lock_guard<std::recursive_mutex> lock(entry_mutex);
+  entry_points = entry_points_t{};
+  scheduler.clear();
+  save_counters();
+}
+
+bool code_t::memo_counters(const std::string& function, uint64_t& hits, uint64_t& misses) const {
+  if (!engine) {
+    return false;
+  }
+  uint64_t hits_address = engine->getGlobalValueAddress(scoped(function + ".memo.hits"));
+  uint64_t misses_address = engine->getGlobalValueAddress(scoped(function + ".memo.misses"));
+  if (!hits_address || !misses_address) {
+    return false;
+  }
+  hits = *reinterpret_cast<const uint64_t*>(hits_address);
+  misses = *reinterpret_cast<const uint64_t*>(misses_address);
+  return true;
+}
+
+bool code_t::link_runtime_bitcode() {
+  if (runtime_bitcode.empty()) {
+    auto Buffer = MemoryBuffer::getFile(runtime_bitcode_path);
+    if (!Buffer) {
+      return false;
+    }
+    runtime_bitcode = (*Buffer)->getBuffer().str();
+  }
+
+  auto Runtime = parseBitcodeFile(MemoryBufferRef(runtime_bitcode, runtime_bitcode_path), *TheContext);
+  if (!Runtime) {
+    debug_cb("Failed to read " + runtime_bitcode_path + ": " + toString(Runtime.takeError()), 1);
+    return false;
+  }
+  (*Runtime)->setTargetTriple(TheModule->getTargetTriple());
+  (*Runtime)->setDataLayout(TheModule->getDataLayout());
+
+  // Only helpers the script declares are pulled in. They become internal and
+  // always-inline, so even the O0 pipeline folds them into the caller.
+  bool Failed = Linker::linkModules(*TheModule, std::move(*Runtime), Linker::Flags::LinkOnlyNeeded,
+    [](Module& M, const StringSet<>& Imported) {
+      for (auto& Name : Imported) {
+        if (Function* F = M.getFunction(Name.getKey()))
+          F->addFnAttr(Attribute::AlwaysInline);
+      }
+      internalizeModule(M, [&Imported](const GlobalValue& GV) {
+        return !GV.hasName() || !Imported.contains(GV.getName());
+      });
+    });
+  return !Failed;
+}
+
+/// write_object_file - writes the in-memory object to path.
+static bool write_object_file(const std::string& path, const SmallVector<char, 0>& object, std::string& error) {
+  std::error_code EC;
+  raw_fd_ostream dest(path, EC, sys::fs::OF_None);
+  if (EC) {
+    error = "Could not open file: " + EC.message();
+    return false;
+  }
+  dest.write(object.data(), object.size());
+  dest.flush();
+  outs() << "Wrote " << path << "\n";
+  return true;
+}
+
+bool code_t::build_imports() {
+  module_interfaces.clear();
+  linked_objects.clear();
+  aot.module_objects.clear();
+
+  std::vector<std::string> imports = scan_imports(code_input);
+  if (imports.empty()) {
+    return true;
+  }
+  std::vector<std::string> paths;
+  for (const auto& import : imports) {
+    paths.push_back(resolve_import(source_path, import));
+  }
+
+  build_options_t options;
+  options.configure = [this](code_t& module) {
+    module.fast_math = fast_math;
+    module.prefetch_asset = prefetch_asset;
+    module.optimize_ast = optimize_ast;
+    module.runtime_bitcode_path = runtime_bitcode_path;
+    module.aot.native_cpu = aot.native_cpu;
+  };
+  build_result_t result = build_modules(paths, options);
+  if (!result.error.empty()) {
+    debug_info.LogError(result.error);
+    return false;
+  }
+
+  std::size_t rebuilt = 0;
+  for (const auto& module : result.modules) {
+    if (!module.compiled) {
+      debug_info.LogError("in module " + module.path + "\n" + module.error_log);
+      continue;
+    }
+    rebuilt += module.rebuilt;
+    linked_objects.push_back(module.object);
+    aot.module_objects.push_back(module_object_path(module.path));
+  }
+  if (!debug_info.compiled) {
+    return false;
+  }
+  for (std::size_t i = 0; i < imports.size(); ++i) {
+    module_interfaces[imports[i]] = result.find(paths[i])->interface;
+  }
+  debug_cb("modules: rebuilt " + std::to_string(rebuilt) + " of " + std::to_string(result.modules.size()), 0);
+  return true;
+}
+
 void code_t::recompile_code() {
   auto start = std::chrono::steady_clock::now();
 
-  InitializeAllTargetInfos();
-  InitializeAllTargets();
-  InitializeAllTargetMCs();
-  InitializeAllAsmParsers();
-  InitializeAllAsmPrinters();
+  // the parser declares the exports of imported modules, they are built, or
+  // reused when up to date, before it runs
+  if (import_modules && !build_imports()) {
+    return;
+  }
 
   //// Run the main "interpreter loop" now.
   main_loop();
 
   //parse_input();
+  HandleCodegen();
 
   // Finalize the debug info.
   DBuilder->finalize();
@@ -216,12 +564,64 @@ void code_t::recompile_code() {
     return;
   }
 
+  if (pgo.rejected) {
+    debug_cb("profile: " + std::to_string(pgo.rejected) + " functions do not match " + profile_path() + ", compiled without it", 0);
+  }
+
   // ir output
-  std::string str;
-  llvm::raw_string_ostream rso(str);
-  TheModule->print(rso, nullptr);
-  rso.flush();
-  debug_cb(str, 0);
+  if (print_ir) {
+    std::string str;
+    llvm::raw_string_ostream rso(str);
+    TheModule->print(rso, nullptr);
+    rso.flush();
+    debug_cb(str, 0);
+  }
+
+  if (!emit_object()) {
+    return;
+  }
+
+  bool linked_output = aot.output != aot_options_t::object;
+  if (linked_output) {
+    // the linker reads the file, it has to be complete first
+    std::string WriteError;
+    if (!write_object_file(aot.object_path, *object, WriteError)) {
+      debug_info.LogError(WriteError + "\n");
+      debug_cb(WriteError, 1);
+      return;
+    }
+    std::string LinkError;
+    if (link_aot(aot, LinkError)) {
+      debug_cb("Linked " + aot.output_path, 0);
+    }
+    else {
+      debug_info.LogError(LinkError + "\n");
+      debug_cb(LinkError, 1);
+    }
+  }
+  else if (aot.write_object) {
+    // nothing waits for the file, keep it off the path to run_code
+    if (object_write.valid()) {
+      object_write.wait();
+    }
+    object_write = std::async(std::launch::async, [Path = aot.object_path, Object = object] {
+      std::string WriteError;
+      if (!write_object_file(Path, *Object, WriteError)) {
+        errs() << WriteError << "\n";
+      }
+    });
+  }
+}
+
+bool code_t::emit_object() {
+  bool runtime_linked = link_runtime_bitcode();
+
+  // snapshot before the backend touches the module, tier-up recompiles from it
+  if (tier.active) {
+    llvm::raw_string_ostream bitcode_stream(tier_bitcode);
+    WriteBitcodeToFile(*TheModule, bitcode_stream);
+    bitcode_stream.flush();
+  }
 
   auto TargetTriple = sys::getDefaultTargetTriple();
   TheModule->setTargetTriple(TargetTriple);
@@ -233,32 +633,119 @@ void code_t::recompile_code() {
   // TargetRegistry or we have a bogus target triple.
   if (!Target) {
     errs() << Error;
-    return;
+    return false;
   }
 
-  auto CPU = "generic";
-  auto Features = "";
+  std::string CPU = "generic";
+  std::string Features = "";
+  if (aot.native_cpu) {
+    CPU = sys::getHostCPUName().str();
+    StringMap<bool> HostFeatures;
+    if (sys::getHostCPUFeatures(HostFeatures)) {
+      SubtargetFeatures SubFeatures;
+      for (auto& Feature : HostFeatures)
+        SubFeatures.AddFeature(Feature.first(), Feature.second);
+      Features = SubFeatures.getString();
+    }
+  }
+  bool linked_output = aot.output != aot_options_t::object;
+  // tiered code starts at O0 (FastISel) and only hot functions pay for the
+  // optimizer
+  CodeGenOptLevel CodeGenLevel = CodeGenOptLevel::Default;
+  if (linked_output) {
+    CodeGenLevel = CodeGenOptLevel::Aggressive;
+  }
+  else if (tier.active) {
+    CodeGenLevel = CodeGenOptLevel::None;
+  }
   TargetOptions opt;
-  auto TheTargetMachine = Target->createTargetMachine(TargetTriple, CPU, Features, opt, Reloc::PIC_);
+  std::unique_ptr<TargetMachine> TheTargetMachine(Target->createTargetMachine(TargetTriple, CPU, Features, opt, Reloc::PIC_,
+    std::nullopt, CodeGenLevel));
   TheModule->setDataLayout(TheTargetMachine->createDataLayout());
-  auto Filename = "output.o";
-  std::error_code EC;
-  raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
-  if (EC) {
-    errs() << "Could not open file: " << EC.message();
-    return;
+
+  // every module may have top-level code, only the importer's main runs
+  if (library_module) {
+    if (Function* MainFn = TheModule->getFunction("main"))
+      MainFn->setLinkage(GlobalValue::InternalLinkage);
+  }
+
+  // The profile only pays off through the optimizer, run it before the
+  // object is emitted.
+  if (pgo.mode == pgo_info_t::use) {
+    set_profile_summary(*TheModule, pgo.profile);
+    optimize_module(*TheModule, std::max(aot.opt_level, 2), TheTargetMachine.get());
+  }
+  else if (linked_output) {
+    optimize_module(*TheModule, aot.opt_level, TheTargetMachine.get());
+  }
+  else if (runtime_linked || llvm::any_of(*TheModule, [](const Function& F) {
+    return F.hasFnAttribute(Attribute::AlwaysInline) && !F.isDeclaration();
+  })) {
+    // the O0 pipeline still runs the always-inliner, for runtime helpers and
+    // '@inline' defs
+    optimize_module(*TheModule, 0, TheTargetMachine.get());
   }
 
+  // the runtime owns the process entry point
+  if (linked_output) {
+    if (Function* MainFn = TheModule->getFunction("main"))
+      MainFn->setName("fpp_main");
+  }
+
+  // One backend run, the JIT loads these bytes and the object file is a
+  // copy of them.
+  auto Object = std::make_shared<SmallVector<char, 0>>();
+  raw_svector_ostream dest(*Object);
+
   legacy::PassManager pass;
   auto FileType = CodeGenFileType::ObjectFile;
   if (TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
     errs() << "TheTargetMachine can't emit a file of this type";
-    return;
+    return false;
   }
 
   pass.run(*TheModule);
-  dest.flush();
-  outs() << "Wrote " << Filename << "\n";
+  object = std::move(Object);
+  return true;
+}
+
+int code_t::interpret_code() {
+  init_parser();
+  main_loop();
+
+  if (debug_info.compiled == false) {
+    debug_cb(debug_info.error_log, 1);
+    debug_cb("Failed to compile", 1);
+    return 1;
+  }
+
+  interpreter.bind(functions);
+
+  // The JIT builds from the same AST while main is being interpreted, calls
+  // made after it is ready run natively.
+  std::thread jit;
+  if (exec_mode == exec_mode_e::interpret_then_jit) {
+    jit = std::thread([this] {
+      init_llvm();
+      HandleCodegen();
+      DBuilder->finalize();
+      if (debug_info.compiled && emit_object() && create_engine()) {
+        interpreter.attach_native(engine.get());
+      }
+    });
+  }
+
+  interpreter_t::value_t result;
+  bool ok = interpreter.call("main", {}, result);
+
+  if (jit.joinable()) {
+    jit.join();
+  }
+  if (!ok) {
+    debug_cb(interpreter.error, 1);
+    return 1;
+  }
+  return 0;
 }
 
 void code_t::set_debug_cb(const std::function<void(const std::string&, int flags)>& cb) {
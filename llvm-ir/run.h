@@ -1,14 +1,117 @@
 #pragma once
 
 #include "parser.h"
+#include "aot.h"
+#include "interpreter.h"
+#include "tiering.h"
+#include "coroutine.h"
 
+#include <future>
+#include <mutex>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/IR/Module.h>
 
 struct code_t : parser_t {
+  ~code_t();
+
+  // init_parser + init_llvm
   void init_code();
+  void init_parser();
+  void init_llvm();
   void recompile_code();
+  // recompile_code hands the IR text to debug_cb
+  bool print_ir = true;
+  // recompile_code builds the modules code_input imports before parsing it
+  bool import_modules = true;
+  bool build_imports();
+  // compiled to be imported, its top-level code stays internal
+  bool library_module = false;
+  // objects of the imported modules, the engine loads them next to object
+  std::vector<std::shared_ptr<const llvm::SmallVector<char, 0>>> linked_objects;
+  // parses code_input into functions, then runs the ast optimizer
   void main_loop();
+  bool optimize_ast = true;
+  // optimizes TheModule and runs the backend once, into object
+  bool emit_object();
+  // loads object into a fresh engine
+  bool create_engine();
+  // runs main as a coroutine, sleep_s suspends it instead of the thread.
+  // Blocks until every script coroutine finished unless cooperative is set,
+  // then it returns once main first sleeps or returns, and the host resumes
+  // the coroutines with poll_scripts.
   int run_code();
+  bool cooperative = false;
+  scheduler_t scheduler;
+  /// poll_scripts - resumes the script coroutines that are due, false while
+  /// a recompile releases them. Never blocks the caller.
+  bool poll_scripts();
+  // optional script functions besides main. run_code calls init once after
+  // main and publishes update for the render loop.
+  struct entry_points_t {
+    double (*init)() = nullptr;
+    double (*update)(double dt) = nullptr;
+    // '<update>.slot' when update is tiered, call_update reads it every
+    // frame so the render loop picks up the optimized body
+    uint64_t* update_slot = nullptr;
+  };
+  entry_points_t entry_points;
+  // held while update or a script coroutine runs and while they are
+  // released, so the engine they live in is never replaced under them.
+  // Recursive because main finishes inside a coroutine.
+  std::recursive_mutex entry_mutex;
+  /// call_update - runs the script's update(dt), false when there is none or
+  /// a recompile is releasing it. Never blocks the caller.
+  bool call_update(double dt);
+  /// release_entry_points - waits for a running update or coroutine, then
+  /// forgets update and drops the coroutines.
+  void release_entry_points();
+  // address of the def name taking arity doubles, 0 if there is none.
+  // Tiered defs resolve to what their slot holds right now.
+  uint64_t find_def(const std::string& name, std::size_t arity);
+  // the '.slot' global tier-up patches for name, null if it is not tiered
+  uint64_t* find_slot(const std::string& name);
+  // rest of run_code once main returned
+  void finish_main();
+  // writes the pgo counters of a finished run to profile_path, once
+  void save_counters();
+  // hit and miss counts of a '@memo' function since its engine was created
+  bool memo_counters(const std::string& function, uint64_t& hits, uint64_t& misses) const;
+
+  enum class exec_mode_e {
+    jit,               // compile everything, then run natively
+    interpret,         // walk the AST, LLVM is never touched
+    interpret_then_jit // interpret right away, switch calls to native code once the JIT is ready
+  };
+  exec_mode_e exec_mode = exec_mode_e::jit;
+  // parses and runs main in the interpreter tier
+  int interpret_code();
+  interpreter_t interpreter;
+
+  std::unique_ptr<llvm::ExecutionEngine> engine;
+
+  // native code of the last compile, shared by the JIT and aot.object_path
+  std::shared_ptr<const llvm::SmallVector<char, 0>> object;
+  // pending background write of object
+  std::future<void> object_write;
+
+  // bitcode of runtime_inline.h, linked into every module when present
+  std::string runtime_bitcode_path = "fpp_runtime.bc";
+  // file contents, read on first use
+  std::string runtime_bitcode;
+  bool link_runtime_bitcode();
+
+  // where and how recompile_code writes its output
+  aot_options_t aot;
+
+  // path of the script, the pgo profile is stored next to it
+  std::string source_path = "test.fpp";
+  std::string profile_path() const { return source_path + ".profdata"; }
+
+  // tier 0 module as bitcode, filled by recompile_code when tier.active
+  std::string tier_bitcode;
+  tiering_t tiering;
 
   void set_debug_cb(const std::function<void(const std::string&, int flags)>& cb);
   std::function<void(const std::string&, int flags)> debug_cb{ [](const std::string&, int flags) {} };
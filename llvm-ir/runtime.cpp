@@ -0,0 +1,8 @@
+// Runtime library for ahead-of-time compiled scripts, archived into
+// libfpp_runtime.a by wsl_build_run.sh.
+
+#include <pch.h>
+
+#include <condition_variable>
+
+#include "library.h"
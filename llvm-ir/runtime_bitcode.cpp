@@ -0,0 +1,5 @@
+// Compiled with -emit-llvm to fpp_runtime.bc by wsl_build_run.sh, the
+// compiler links it into every module before optimization.
+
+#define FPP_RUNTIME_INLINE_IMPLEMENTATION
+#include "runtime_inline.h"
@@ -0,0 +1,68 @@
+#pragma once
+
+//===----------------------------------------------------------------------===//
+// Small runtime helpers that are safe to inline into scripts.
+//
+// Besides being part of library.h, this header is compiled on its own to
+// fpp_runtime.bc (see runtime_bitcode.cpp). The compiler links that bitcode
+// into every module, so calls from script loops inline instead of going
+// through the extern. Keep it free of fan, locks and the task queue.
+//
+// Any file may include it for the declarations. The one translation unit of
+// a binary that exports the helpers defines FPP_RUNTIME_INLINE_IMPLEMENTATION
+// first: library.h for the host and the ahead-of-time runtime,
+// runtime_bitcode.cpp for the bitcode.
+//===----------------------------------------------------------------------===//
+
+#include <cstdint>
+#include <cstdio>
+
+#ifndef DLLEXPORT
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+#endif
+
+/// putchard - putchar that takes a double and returns 0.
+extern "C" DLLEXPORT double putchard(double x);
+/// clamp - x limited to [lo, hi].
+extern "C" DLLEXPORT double clamp(double x, double lo, double hi);
+/// lerp - linear interpolation from a to b.
+extern "C" DLLEXPORT double lerp(double a, double b, double t);
+/// rgb - packs 0-255 channels into the hex color rectangle1 takes.
+extern "C" DLLEXPORT double rgb(double r, double g, double b);
+/// rgba - rgb with alpha.
+extern "C" DLLEXPORT double rgba(double r, double g, double b, double a);
+/// radians - degrees to radians.
+extern "C" DLLEXPORT double radians(double degrees);
+
+#ifdef FPP_RUNTIME_INLINE_IMPLEMENTATION
+
+extern "C" DLLEXPORT double putchard(double x) {
+  fputc((char)x, stderr);
+  return 0;
+}
+
+extern "C" DLLEXPORT double clamp(double x, double lo, double hi) {
+  return x < lo ? lo : x > hi ? hi : x;
+}
+
+extern "C" DLLEXPORT double lerp(double a, double b, double t) {
+  return a + (b - a) * t;
+}
+
+extern "C" DLLEXPORT double rgb(double r, double g, double b) {
+  return (double)(((uint32_t)r & 0xff) << 24 | ((uint32_t)g & 0xff) << 16 | ((uint32_t)b & 0xff) << 8 | 0xff);
+}
+
+extern "C" DLLEXPORT double rgba(double r, double g, double b, double a) {
+  return (double)(((uint32_t)r & 0xff) << 24 | ((uint32_t)g & 0xff) << 16 | ((uint32_t)b & 0xff) << 8 | ((uint32_t)a & 0xff));
+}
+
+extern "C" DLLEXPORT double radians(double degrees) {
+  return degrees * 0.017453292519943295;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+//===----------------------------------------------------------------------===//
+// Task ring
+//
+// Bounded multi-producer/single-consumer queue after Dmitry Vyukov's bounded
+// MPMC queue. Every cell carries a sequence number telling whose turn it is:
+// a producer claims a position with one CAS on the tail, writes the cell and
+// publishes it by bumping the sequence, the consumer reads cells in order
+// until it reaches one that is not published yet. Producers never wait for
+// each other beyond a failed CAS, and the consumer never waits at all.
+//===----------------------------------------------------------------------===//
+
+template <typename T, std::size_t Capacity>
+struct task_ring_t {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+  task_ring_t() : cells(new cell_t[Capacity]) {
+    for (std::size_t i = 0; i < Capacity; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// try_push - false when the ring is full.
+  bool try_push(T&& value) {
+    std::size_t position = tail.load(std::memory_order_relaxed);
+    while (true) {
+      cell_t& cell = cells[position & mask];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      auto lap = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+      if (lap == 0) {
+        if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (lap < 0) {
+        return false;
+      }
+      else {
+        position = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// drain - calls f on every published value in order and returns how many
+  /// there were. Consumer only, stops after one lap so producers cannot keep
+  /// it busy.
+  template <typename F>
+  std::size_t drain(F&& f) {
+    std::size_t position = head.load(std::memory_order_relaxed);
+    std::size_t count = 0;
+    for (; count < Capacity; ++count, ++position) {
+      cell_t& cell = cells[position & mask];
+      if (cell.sequence.load(std::memory_order_acquire) != position + 1) {
+        break;
+      }
+      f(cell.value);
+      if constexpr (!std::is_trivially_copyable_v<T>) {
+        cell.value = T{};
+      }
+      cell.sequence.store(position + Capacity, std::memory_order_release);
+    }
+    head.store(position, std::memory_order_release);
+    return count;
+  }
+
+  /// empty - true when every claimed cell was consumed.
+  bool empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+  static constexpr std::size_t capacity() {
+    return Capacity;
+  }
+
+private:
+  static constexpr std::size_t mask = Capacity - 1;
+  // keeps the producer and consumer counters off each other's cache line
+  static constexpr std::size_t line = 64;
+
+  struct cell_t {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<cell_t[]> cells;
+  alignas(line) std::atomic<std::size_t> tail{ 0 };
+  alignas(line) std::atomic<std::size_t> head{ 0 };
+};
+
+struct task_ring_bench_t {
+  unsigned producers = 0;
+  uint64_t items = 0;
+  double ring_seconds = 0;
+  double mutex_seconds = 0;
+};
+
+/// bench_task_ring - moves items values from producers threads to one
+/// consumer through a task_ring_t and through a mutex guarded vector, the
+/// scheme it replaced.
+inline task_ring_bench_t bench_task_ring(unsigned producers, uint64_t items) {
+  using clock = std::chrono::steady_clock;
+  task_ring_bench_t result;
+  result.producers = producers = std::max(1u, producers);
+  result.items = items = items / producers * producers;
+
+  auto run = [&](auto&& produce, auto&& consume) {
+    std::atomic<bool> go{ false };
+    std::vector<std::thread> threads;
+    for (unsigned p = 0; p < producers; ++p) {
+      threads.emplace_back([&, p] {
+        while (!go.load(std::memory_order_acquire)) {
+          std::this_thread::yield();
+        }
+        produce(p);
+      });
+    }
+    auto start = clock::now();
+    go.store(true, std::memory_order_release);
+    uint64_t consumed = 0, sum = 0;
+    while (consumed < items) {
+      consumed += consume(sum);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+
+  {
+    auto ring = std::make_unique<task_ring_t<uint64_t, 1 << 16>>();
+    result.ring_seconds = run([&](unsigned p) {
+      for (uint64_t i = p; i < items; i += producers) {
+        uint64_t value = i;
+        while (!ring->try_push(std::move(value))) {
+          std::this_thread::yield();
+        }
+      }
+    }, [&](uint64_t& sum) {
+      return ring->drain([&](uint64_t value) { sum += value; });
+    });
+  }
+  {
+    std::mutex mutex;
+    std::vector<uint64_t> queue;
+    result.mutex_seconds = run([&](unsigned p) {
+      for (uint64_t i = p; i < items; i += producers) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(i);
+      }
+    }, [&](uint64_t& sum) {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (uint64_t value : queue) {
+        sum += value;
+      }
+      std::size_t count = queue.size();
+      queue.clear();
+      return count;
+    });
+  }
+  return result;
+}
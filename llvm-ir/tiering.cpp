@@ -0,0 +1,182 @@
+#include "tiering.h"
+
+#include <atomic>
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/TargetParser/Host.h>
+
+#include "codegen.h"
+
+using namespace llvm;
+
+struct tiering_t::unit_t {
+  std::unique_ptr<LLVMContext> context;
+  std::unique_ptr<ExecutionEngine> engine;
+
+  ~unit_t() {
+    // engine owns a module living in context
+    engine.reset();
+  }
+};
+
+extern "C" void fpp_tier_up(void* state, uint32_t index) {
+  static_cast<tiering_t*>(state)->request(index);
+}
+
+tiering_t::tiering_t() = default;
+
+tiering_t::~tiering_t() {
+  stop();
+}
+
+void tiering_t::start(ExecutionEngine* base_engine, std::string tier0_bitcode, std::vector<std::string> tier0_functions) {
+  stop();
+  base = base_engine;
+  bitcode = std::move(tier0_bitcode);
+  functions = std::move(tier0_functions);
+  quit = false;
+  worker = std::thread([this] { worker_loop(); });
+}
+
+void tiering_t::request(uint32_t index) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(index);
+  }
+  cv.notify_one();
+}
+
+void tiering_t::stop() {
+  if (worker.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    cv.notify_one();
+    worker.join();
+  }
+  pending.clear();
+  units.clear();
+  base = nullptr;
+}
+
+void tiering_t::worker_loop() {
+  while (true) {
+    uint32_t index;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this] { return quit || !pending.empty(); });
+      if (quit) {
+        return;
+      }
+      index = pending.front();
+      pending.pop_front();
+    }
+    compile(index);
+  }
+}
+
+void tiering_t::compile(uint32_t index) {
+  if (index >= functions.size()) {
+    return;
+  }
+  const std::string& name = functions[index];
+  uint64_t address = optimize(name);
+  uint64_t slot = base->getGlobalValueAddress(name + ".slot");
+  if (!address || !slot) {
+    log("tier-up: failed to link " + name, 1);
+    return;
+  }
+  std::atomic_ref<uint64_t>(*reinterpret_cast<uint64_t*>(slot)).store(address, std::memory_order_release);
+  log("tier-up: " + name + " recompiled at O2", 0);
+}
+
+uint64_t tiering_t::compile_now(const std::string& name) {
+  uint64_t address = optimize(name);
+  if (address) {
+    log("tier-up: " + name + " compiled at O2", 0);
+  }
+  return address;
+}
+
+uint64_t tiering_t::optimize(const std::string& name) {
+  // Every recompile gets its own context so it never touches the one the
+  // script thread may still be using.
+  auto unit = std::make_unique<unit_t>();
+  unit->context = std::make_unique<LLVMContext>();
+
+  auto module = parseBitcodeFile(MemoryBufferRef(bitcode, "tier0"), *unit->context);
+  if (!module) {
+    log("tier-up: " + toString(module.takeError()), 1);
+    return 0;
+  }
+  Module& M = **module;
+
+  // Keep only the hot function, everything else resolves to the tier 0 copy.
+  // Local functions, e.g. the runtime helpers, have no symbol to resolve
+  // against and keep a copy of their own.
+  for (Function& F : M) {
+    if (F.getName() != name && !F.isDeclaration() && !F.hasLocalLinkage()) {
+      F.deleteBody();
+    }
+  }
+  for (GlobalVariable& G : M.globals()) {
+    if (!G.hasLocalLinkage() && !G.isDeclaration()) {
+      G.setInitializer(nullptr);
+      G.setLinkage(GlobalValue::ExternalLinkage);
+    }
+  }
+  StripDebugInfo(M);
+
+  std::string error;
+  TargetMachine* target_machine = EngineBuilder()
+    .setMCPU(sys::getHostCPUName())
+    .setOptLevel(CodeGenOptLevel::Aggressive)
+    .selectTarget();
+  if (!target_machine) {
+    log("tier-up: failed to select target", 1);
+    return 0;
+  }
+  M.setDataLayout(target_machine->createDataLayout());
+  optimize_module(M, 2, target_machine);
+
+  std::vector<std::string> imports;
+  for (GlobalValue& G : M.global_values()) {
+    if (G.isDeclaration() && !G.getName().starts_with("llvm.") && G.getName() != "fpp_tier_up" && G.getName() != "fpp.tier.state") {
+      imports.push_back(G.getName().str());
+    }
+  }
+
+  unit->engine.reset(EngineBuilder(std::move(*module))
+    .setErrorStr(&error)
+    .setMCPU(sys::getHostCPUName())
+    .setOptLevel(CodeGenOptLevel::Aggressive)
+    .create(target_machine));
+  if (!unit->engine) {
+    log("tier-up: " + error, 1);
+    return 0;
+  }
+
+  for (const auto& import : imports) {
+    if (uint64_t address = base->getGlobalValueAddress(import)) {
+      unit->engine->addGlobalMapping(import, address);
+    }
+  }
+  unit->engine->addGlobalMapping("fpp_tier_up", reinterpret_cast<uint64_t>(&fpp_tier_up));
+  unit->engine->addGlobalMapping("fpp.tier.state", reinterpret_cast<uint64_t>(this));
+  unit->engine->finalizeObject();
+
+  uint64_t address = unit->engine->getFunctionAddress(name);
+  if (address) {
+    std::lock_guard<std::mutex> lock(units_mutex);
+    units.push_back(std::move(unit));
+  }
+  return address;
+}
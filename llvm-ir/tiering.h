@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace llvm {
+  class ExecutionEngine;
+  class LLVMContext;
+}
+
+//===----------------------------------------------------------------------===//
+// Tiered compilation
+//
+// Tier 0 is compiled at -O0 with an entry and back-edge counter per function.
+// Calls between script functions load their target from a '<name>.slot'
+// global. When a counter reaches the threshold the function calls
+// fpp_tier_up, which queues it for a background recompile with the full
+// optimizer; the optimized body is then patched into the slot. main is
+// counted like any other function, but a running main is never swapped, so
+// its loops stay at tier 0 unless the host opts into compile_now before it
+// starts.
+//===----------------------------------------------------------------------===//
+
+struct tiering_t {
+  // out of line, unit_t is only complete in tiering.cpp
+  tiering_t();
+  ~tiering_t();
+
+  // base must be finalized, bitcode is the tier 0 module before codegen
+  void start(llvm::ExecutionEngine* base, std::string bitcode, std::vector<std::string> functions);
+  // called from the script thread, only queues the work
+  void request(uint32_t index);
+  // optimizes the function name right away, its address or 0
+  uint64_t compile_now(const std::string& name);
+  // joins the worker and releases optimized code
+  void stop();
+
+  std::function<void(const std::string&, int flags)> log{ [](const std::string&, int flags) {} };
+
+private:
+  void worker_loop();
+  void compile(uint32_t index);
+  // the optimized copy of name in a new unit, 0 on failure
+  uint64_t optimize(const std::string& name);
+
+  // optimized function, defined in tiering.cpp
+  struct unit_t;
+
+  llvm::ExecutionEngine* base = nullptr;
+  std::string bitcode;
+  std::vector<std::string> functions;
+  std::vector<std::unique_ptr<unit_t>> units;
+  // compile_now may run next to the worker
+  std::mutex units_mutex;
+
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<uint32_t> pending;
+  bool quit = false;
+};
+
+extern "C" void fpp_tier_up(void* state, uint32_t index);
@@ -93,18 +93,33 @@ void t0(code_t& code) {
   std::unique_lock lk(g_mutex);
   g_cv.wait(lk, [] { return ready; });
 
-  code.init_code();
+  // update runs on the render thread, stop it before its code goes away
+  code.release_entry_points();
+  fpp_wait_tasks();
+  reset_buffers();
+
   fan::time::clock c;
-  c.start();
+  if (code.exec_mode == code_t::exec_mode_e::jit) {
+    code.init_code();
+    c.start();
 
-  code.recompile_code();
-  uint64_t compile_time = c.elapsed();
-  code.run_code();
+    code.recompile_code();
+    uint64_t compile_time = c.elapsed();
+    code.run_code();
 
-  lib_queue.push_back([elapsed = c.elapsed(), compile_time] {
-    fan::printclh(loco_t::console_t::highlight_e::success, "Compile time: ", compile_time / 1e6, "ms");
-    fan::printclh(loco_t::console_t::highlight_e::success, "Program boot time: ", elapsed / 1e6, "ms");
-  });
+    lib_queue.push_back([elapsed = c.elapsed(), compile_time] {
+      fan::printclh(loco_t::console_t::highlight_e::success, "Compile time: ", compile_time / 1e6, "ms");
+      fan::printclh(loco_t::console_t::highlight_e::success, "Program boot time: ", elapsed / 1e6, "ms");
+    });
+  }
+  else {
+    c.start();
+    code.interpret_code();
+
+    lib_queue.push_back([elapsed = c.elapsed()] {
+      fan::printclh(loco_t::console_t::highlight_e::success, "Interpreted run time: ", elapsed / 1e6, "ms");
+    });
+  }
 
   processed = true;
   ready = false;
@@ -119,6 +134,12 @@ struct debug_info_t {
 
 int main() {
   code_t code;
+  register_library(code.interpreter);
+  // main starts on t0, once it sleeps the render loop resumes the scripts, so
+  // sleep_s never blocks t0 and main never blocks a frame before it sleeps
+  code.cooperative = true;
+  // sprite images start decoding while the script compiles
+  code.prefetch_asset = fpp_prefetch_asset;
 
   std::vector<debug_info_t> debug_info;
   code.set_debug_cb([&debug_info](const std::string& info, int flags) {
@@ -138,9 +159,55 @@ int main() {
   pile.loco.render_console = true;
 
   pile.loco.console.commands.add("clear_shapes", [](const fan::commands_t::arg_t& args) {
-    shapes.clear();
+    reset_shapes();
   }).description = "clears all shapes within the program";
 
+  pile.loco.console.commands.add("fast_math", [&code](const fan::commands_t::arg_t& args) {
+    code.fast_math = !code.fast_math;
+    fan::printclh(loco_t::console_t::highlight_e::info, "fast-math: ", code.fast_math ? "on" : "off");
+  }).description = "toggles fast-math floating point for compiled code";
+
+  pile.loco.console.commands.add("ast_opt", [&code](const fan::commands_t::arg_t& args) {
+    code.optimize_ast = !code.optimize_ast;
+    fan::printclh(loco_t::console_t::highlight_e::info, "ast optimizer: ", code.optimize_ast ? "on" : "off");
+  }).description = "toggles constant folding, dead branch pruning and cse before codegen";
+
+  pile.loco.console.commands.add("tiered", [&code](const fan::commands_t::arg_t& args) {
+    code.tier.enabled = !code.tier.enabled;
+    fan::printclh(loco_t::console_t::highlight_e::info, "tiered compilation: ", code.tier.enabled ? "on" : "off");
+  }).description = "toggles -O0 first compile with background recompilation of hot functions";
+
+  pile.loco.console.commands.add("tier_main", [&code](const fan::commands_t::arg_t& args) {
+    code.tier.optimize_main = !code.tier.optimize_main;
+    fan::printclh(loco_t::console_t::highlight_e::info, "optimized main: ", code.tier.optimize_main ? "on" : "off");
+  }).description = "toggles compiling a main with loops at O2 before it runs when tiered";
+
+  pile.loco.console.commands.add("pgo", [&code](const fan::commands_t::arg_t& args) {
+    code.pgo.enabled = !code.pgo.enabled;
+    fan::printclh(loco_t::console_t::highlight_e::info, "profile guided optimization: ", code.pgo.enabled ? "on" : "off");
+  }).description = "toggles instrumented runs and recompiling with the saved profile";
+
+  pile.loco.console.commands.add("interpret", [&code](const fan::commands_t::arg_t& args) {
+    using exec_mode_e = code_t::exec_mode_e;
+    code.exec_mode = code.exec_mode == exec_mode_e::jit ? exec_mode_e::interpret_then_jit : exec_mode_e::jit;
+    fan::printclh(loco_t::console_t::highlight_e::info, "interpreter tier: ", code.exec_mode == exec_mode_e::jit ? "off" : "on");
+  }).description = "toggles starting scripts in the interpreter while the JIT compiles";
+
+  pile.loco.console.commands.add("write_object", [&code](const fan::commands_t::arg_t& args) {
+    code.aot.write_object = !code.aot.write_object;
+    fan::printclh(loco_t::console_t::highlight_e::info, "write ", code.aot.object_path, ": ", code.aot.write_object ? "on" : "off");
+  }).description = "toggles writing the compiled object file next to the JIT run";
+
+  pile.loco.console.commands.add("bench_queue", [](const fan::commands_t::arg_t& args) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned producers : { 1u, 2u, 4u, cores }) {
+      task_ring_bench_t bench = bench_task_ring(producers, 1 << 22);
+      fan::printclh(loco_t::console_t::highlight_e::info,
+        producers, " producers, ", bench.items, " items: ring ", bench.ring_seconds * 1e3,
+        "ms, mutex ", bench.mutex_seconds * 1e3, "ms");
+    }
+  }).description = "compares the lock-free task queue with a mutex guarded vector";
+
   pile.loco.console.commands.add("print_debug", [&debug_info](const fan::commands_t::arg_t& args) {
     for (const auto& i : debug_info) {
       fan::printclh(i.flags, i.info);
@@ -149,6 +216,7 @@ int main() {
 
   TextEditor editor, input;
   auto file_name = "test.fpp";
+  code.source_path = file_name;
 
   init_graphics(editor, file_name);
 
@@ -157,12 +225,9 @@ int main() {
   pile.loco.input_action.add_keycombo({ fan::key_left_control, fan::key_s }, "save_file");
   pile.loco.input_action.add_keycombo({ fan::key_f5 }, "compile_and_run");
 
-  uint32_t task_id = 0, sleep_id = 0;
-
-  auto compile_and_run = [&editor, &code, &task_id, &sleep_id] {
+  auto compile_and_run = [&editor, &code] {
 
-    models.clear();
-    gloco->m_pre_draw.clear();
+    clear_models();
     fan::printclh(loco_t::console_t::highlight_e::info, "Compiling...");
     code.code_input = editor.GetText();
     if (code.code_input.back() == '\n') {
@@ -192,15 +257,19 @@ int main() {
     }
   });
 
+  auto last_frame = std::chrono::steady_clock::now();
+
   pile.loco.loop([&] {
 
-    {
-      std::lock_guard<std::mutex> lock(task_queue_mutex);
-      for (auto& i : task_queue) {
-        i();
-      }
-      task_queue.clear();
-    }
+    auto now = std::chrono::steady_clock::now();
+    double dt = std::chrono::duration<double>(now - last_frame).count();
+    last_frame = now;
+    // sleeping scripts whose timers fired, then one native update call, the
+    // commands of both are applied right after
+    code.poll_scripts();
+    code.call_update(dt);
+
+    fpp_run_tasks();
 
     ImGui::Begin("window");
     ImGui::SameLine();
@@ -236,27 +305,6 @@ int main() {
         i();
       }
       lib_queue.clear();
-
-      //std::lock_guard<std::mutex> lk(task_queue_mutex);
-      //if (code_sleep) {
-      //  if (sleep_timers[sleep_id].finished()) {
-      //    ++sleep_id;
-      //    code_sleep = false;
-      //  }
-      //}
-      //for (uint32_t i = task_id; code_sleep == false && i < task_queue.size(); ++i) {
-      //  task_queue[task_id++]();
-      //  if (code_sleep) {
-      //    sleep_timers[sleep_id].start();
-      //    break;
-      //  }
-      //}
-      //if (task_id == task_queue.size()) {
-      //  task_id = 0;
-      //  processed = false;
-      //  sleep_id = 0;
-      //  clean_up();
-      //}
     }
 
   });
@@ -5,6 +5,7 @@
 
 #include "llvm-ir/run.h"
 #include "llvm-ir/library.h"
+#include "llvm-ir/batch.h"
 
 std::mutex g_mutex;
 std::condition_variable g_cv;
@@ -25,10 +26,119 @@ void t0(code_t& code) {
   t0(code);
 }
 
-int main() {
+// compiles every file into <file>.o on all cores
+int run_batch(const std::vector<std::string>& paths) {
+  batch_options_t options;
+  options.configure = [](code_t& code) {
+    code.aot.write_object = true;
+  };
+  auto start = std::chrono::steady_clock::now();
+  auto results = compile_batch(paths, options);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int failed = 0;
+  for (const auto& result : results) {
+    if (result.compiled) {
+      printf("%s: ok, %.3fs\n", result.path.c_str(), result.seconds);
+    }
+    else {
+      printf("%s: failed\n%s", result.path.c_str(), result.error_log.c_str());
+      ++failed;
+    }
+  }
+  printf("compiled %zu of %zu files in %.3fs\n", results.size() - failed, results.size(), seconds);
+  return failed ? 1 : 0;
+}
+
+// task queue against a mutex guarded vector, one to all cores producing
+int run_bench_queue() {
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned producers : { 1u, 2u, 4u, cores }) {
+    task_ring_bench_t bench = bench_task_ring(producers, 1 << 22);
+    printf("%u producers, %llu items: ring %.2fms, mutex %.2fms\n", producers,
+      (unsigned long long)bench.items, bench.ring_seconds * 1e3, bench.mutex_seconds * 1e3);
+  }
+  return 0;
+}
+
+// library calls from creation to the scene, recorded in memory
+int run_bench_runtime() {
+  for (uint32_t shapes : { 1u << 12, 1u << 16, 1u << 20 }) {
+    runtime_bench_t bench = bench_runtime(shapes);
+    printf("%llu shapes: create %.2fms, move %.2fms, bulk create %.2fms%s\n",
+      (unsigned long long)bench.shapes, bench.create_seconds * 1e3, bench.move_seconds * 1e3,
+      bench.bulk_seconds * 1e3, bench.live_shapes == 2ull * shapes ? "" : ", wrong shape count");
+  }
+  return 0;
+}
+
+// runs the script against the recording backend and prints the scene it
+// leaves, diffable between builds
+int run_record(const char* file_name) {
+  recording_backend_t recording;
+  set_backend(&recording);
+
+  code_t code;
+  code.source_path = file_name;
+  fan::io::file::read(file_name, &code.code_input);
+  code.code_input.push_back(EOF);
+  // stdout is the scene, errors go to stderr
+  code.set_debug_cb([](const std::string& info, int flags) {
+    if (flags == 1) {
+      fprintf(stderr, "%s\n", info.c_str());
+    }
+  });
+  code.print_ir = false;
+  code.init_code();
+  code.recompile_code();
+  if (code.run_code() != 0) {
+    return 1;
+  }
+  code.release_entry_points();
+
+  // sprites get their images once the loader is idle
+  fpp_run_tasks();
+  asset_loader().wait_idle();
+  fpp_run_tasks();
+  printf("%s", recording.dump().c_str());
+  set_backend(nullptr);
+  return 0;
+}
+
+// usage: a.out [--exe <output> | --shared <output>] [file.fpp]
+//        a.out --batch file.fpp...
+//        a.out --bench-queue
+//        a.out --bench-runtime
+//        a.out --record file.fpp
+int main(int argc, char** argv) {
+  if (argc > 1 && std::string(argv[1]) == "--batch") {
+    return run_batch(std::vector<std::string>(argv + 2, argv + argc));
+  }
+  if (argc > 1 && std::string(argv[1]) == "--bench-queue") {
+    return run_bench_queue();
+  }
+  if (argc > 1 && std::string(argv[1]) == "--bench-runtime") {
+    return run_bench_runtime();
+  }
+  if (argc > 2 && std::string(argv[1]) == "--record") {
+    return run_record(argv[2]);
+  }
+
   code_t code;
 
-  auto file_name = "test.fpp";
+  const char* file_name = "test.fpp";
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "--exe" || arg == "--shared") && i + 1 < argc) {
+      code.aot.output = arg == "--exe" ? aot_options_t::executable : aot_options_t::shared_library;
+      code.aot.output_path = argv[++i];
+    }
+    else {
+      file_name = argv[i];
+    }
+  }
+  code.source_path = file_name;
+  code.aot.write_object = true;
   fan::io::file::read(file_name, &code.code_input);
   code.code_input.push_back(EOF);
 
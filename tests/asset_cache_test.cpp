@@ -0,0 +1,113 @@
+// Headless checks of the asset pipeline: the LRU's eviction order and byte
+// count, and the loader decoding through a stub instead of a file reader.
+// Exits with 1 on the first failed check.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../llvm-ir/asset_cache.h"
+
+#define check(condition) \
+  do { \
+    if (!(condition)) { \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      std::exit(1); \
+    } \
+  } while (0)
+
+static std::shared_ptr<const decoded_image_t> image_of(std::size_t bytes) {
+  auto image = std::make_shared<decoded_image_t>();
+  image->pixels.resize(bytes);
+  return image;
+}
+
+static asset_key_t key_of(const fpp_string_t& path) {
+  return asset_key_t{ fpp_view(path), path.hash };
+}
+
+static void test_lru() {
+  fpp_string_t a = fpp_make_string("a", 1), b = fpp_make_string("b", 1), c = fpp_make_string("c", 1);
+  image_lru_t lru(100);
+
+  lru.insert(key_of(a), image_of(40));
+  lru.insert(key_of(b), image_of(40));
+  check(lru.count() == 2 && lru.size_bytes() == 80);
+
+  // a becomes most recent, so c pushes out b
+  check(lru.find(key_of(a)));
+  lru.insert(key_of(c), image_of(40));
+  check(lru.count() == 2 && lru.size_bytes() == 80);
+  check(!lru.find(key_of(b)));
+  check(lru.find(key_of(a)) && lru.find(key_of(c)));
+
+  // replacing an image accounts for the old one
+  lru.insert(key_of(a), image_of(10));
+  check(lru.count() == 2 && lru.size_bytes() == 50);
+
+  // larger than the whole cache: not kept, and the old image goes too
+  lru.insert(key_of(c), image_of(101));
+  check(!lru.find(key_of(c)));
+  check(lru.count() == 1 && lru.size_bytes() == 10);
+}
+
+// "<w>x<h>" decodes to w*h rgba pixels, anything else fails
+static std::atomic<int> decodes{ 0 };
+static bool stub_decoder(const std::string& path, decoded_image_t& image) {
+  ++decodes;
+  unsigned width, height;
+  if (std::sscanf(path.c_str(), "%ux%u", &width, &height) != 2) {
+    return false;
+  }
+  image.width = width;
+  image.height = height;
+  image.channels = 4;
+  image.pixels.assign(std::size_t(width) * height * 4, 0xff);
+  return true;
+}
+
+static void test_loader() {
+  asset_loader_t loader(stub_decoder, 1024, 2);
+  fpp_string_t small = fpp_make_string("4x4", 3), medium = fpp_make_string("8x8", 3);
+  fpp_string_t large = fpp_make_string("16x16", 5), broken = fpp_make_string("broken", 6);
+
+  // the first requests only queue
+  check(!loader.request(small));
+  check(!loader.request(medium));
+  check(!loader.request(broken));
+  loader.wait_idle();
+  check(decodes == 3);
+  check(loader.cache_bytes() == 64 + 256);
+
+  std::vector<asset_loader_t::ready_t> ready;
+  loader.take_ready(ready);
+  check(ready.size() == 3);
+  for (const auto& result : ready) {
+    check((result.path == "broken") == !result.image);
+  }
+  ready.clear();
+  loader.take_ready(ready);
+  check(ready.empty());
+
+  // hits come back at once without decoding again
+  auto hit = loader.request(medium);
+  check(hit && hit->width == 8 && hit->bytes() == 256);
+  check(decodes == 3);
+
+  // fills the cache alone, so both smaller images are evicted
+  check(!loader.request(large));
+  loader.wait_idle();
+  check(loader.cache_bytes() == 1024);
+  check(!loader.request(medium));
+  loader.wait_idle();
+  check(decodes == 5);
+  check(loader.cache_bytes() == 256);
+}
+
+int main() {
+  test_lru();
+  test_loader();
+  std::printf("asset_cache_test: ok\n");
+  return 0;
+}
@@ -1,4 +1,28 @@
 #!/bin/bash
 clang++ -g -c llvm-ir/run.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o run.o
 clang++ -g -c llvm-ir/codegen.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o codegen.o
-clang++ -g nographics.cpp /mnt/c/libs/fan_release/include/fan/io/file.cpp /mnt/c/libs/fan_release/include/fan/types/fstring.cpp -lLLVM-18 -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o a.out codegen.o run.o -w -Dno_graphics
+clang++ -g -c llvm-ir/tiering.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o tiering.o
+clang++ -g -c llvm-ir/pgo.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o pgo.o
+clang++ -g -c llvm-ir/interpreter.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o interpreter.o
+clang++ -g -c llvm-ir/ast_optimizer.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o ast_optimizer.o
+clang++ -g -c llvm-ir/aot.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o aot.o
+clang++ -g -c llvm-ir/batch.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o batch.o
+clang++ -g -c llvm-ir/module.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o module.o
+clang++ -g -c llvm-ir/coroutine.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o coroutine.o
+clang++ -g -c llvm-ir/asset_cache.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o asset_cache.o
+clang++ -g nographics.cpp /mnt/c/libs/fan_release/include/fan/io/file.cpp /mnt/c/libs/fan_release/include/fan/types/fstring.cpp -lLLVM-18 -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -o a.out codegen.o tiering.o pgo.o interpreter.o ast_optimizer.o aot.o batch.o module.o coroutine.o asset_cache.o run.o -w -Dno_graphics
+# runtime for ahead-of-time compiled scripts (a.out --exe/--shared)
+clang++ -O3 -march=native -fPIC -c llvm-ir/runtime.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -Dno_graphics -o fpp_runtime.o
+clang++ -O3 -march=native -fPIC -c llvm-ir/coroutine.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -Dno_graphics -o fpp_coroutine.o
+clang++ -O3 -march=native -fPIC -c llvm-ir/asset_cache.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -Dno_graphics -o fpp_asset_cache.o
+ar rcs libfpp_runtime.a fpp_runtime.o fpp_coroutine.o fpp_asset_cache.o
+# inlinable runtime helpers, linked into every compiled module
+clang++ -O2 -emit-llvm -c llvm-ir/runtime_bitcode.cpp -std=c++2a -o fpp_runtime.bc
+clang++ -O3 -march=native -fPIC -c llvm-ir/aot_main.cpp -std=c++2a -I /mnt/c/libs/fan_release/include/fan -I /mnt/c/Users/0b347/Documents/GitHub -Dloco_imgui -DIMGUI_IMPL_OPENGL_LOADER_CUSTOM -DIMGUI_DEFINE_MATH_OPERATORS -I /usr/include/llvm-18/ -Dloco_json -I /mnt/c/libs/fan_release/include/ -Wall -Wextra -Wno-unused-parameter -Dno_graphics -o fpp_main.o
+# headless tests, a failure stops the script
+clang++ -g tests/asset_cache_test.cpp llvm-ir/asset_cache.cpp -std=c++2a -Wall -Wextra -Wno-unused-parameter -o asset_cache_test || exit 1
+./asset_cache_test || exit 1
+# recorded scenes, a.out --record must reproduce every golden file
+for script in tests/record/*.fpp; do
+  ./a.out --record "$script" | diff -u "${script%.fpp}.golden" - || exit 1
+done